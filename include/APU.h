@@ -2,6 +2,9 @@
 #include <cstdint>
 #include <functional>
 
+class StateWriter;
+class StateReader;
+
 class APU {
 public:
     APU();
@@ -14,12 +17,16 @@ public:
 
     double GetOutputSample();
 
+    // Save states
+    void saveState(StateWriter& state);
+    bool loadState(StateReader& state, uint16_t version);
+
 private:
     uint32_t frame_clock_counter = 0;
     uint32_t clock_counter = 0;
 
     // Length Counter Lookup Table
-    uint8_t length_table[32] = { 10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14, 12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30 };
+    static const uint8_t length_table[32];
 
     struct Sequencer {
         uint32_t sequence = 0;
@@ -2,21 +2,37 @@
 #include <cstdint>
 #include <array>
 #include <memory>
+#include <vector>
 #include "Cartridge.h"
+#include "CPU.h"
 #include "PPU.h"
 #include "APU.h"
+#include "PerfCounters.h"
+#include "OutputBuffer.h"
 
-class CPU; // Forward declaration
+class Trace;
+class Heatmap;
+class StateWriter;
+class StateReader;
 
 class Bus {
 public:
     Bus();
     ~Bus();
 
-    // Devices on the bus
-    std::shared_ptr<CPU> cpu;
-    std::shared_ptr<PPU> ppu;
-    std::shared_ptr<APU> apu;
+    // Independent copy of the whole machine. The ROM image is shared, all
+    // mutable state (RAM, registers, CHR-RAM, PRG-RAM) is copied. Pending
+    // audio, the picture drawn so far and any external video output target
+    // are not carried over; the copy's next frame draws a whole picture.
+    std::unique_ptr<Bus> clone() const;
+
+    // Devices on the bus. The chips are part of the Bus itself and need no
+    // allocations of their own; a machine's other heap blocks are its
+    // Cartridge (CHR-RAM and PRG-RAM, the ROM image is shared), and the
+    // screen and audio buffers once something is drawn or sampled.
+    CPU cpu;
+    PPU ppu;
+    APU apu;
     std::shared_ptr<Cartridge> cart;
     
     // 2KB System RAM
@@ -28,11 +44,81 @@ public:
     void insertCartridge(const std::shared_ptr<Cartridge>& cartridge);
     void reset();
     void clock();
-    
+
+    // Advance the CPU and APU by one CPU cycle, leaving the PPU untouched
+    void clockCPU();
+
+    // Run the system for one video frame (341 * 262 PPU cycles)
+    void clockFrame();
+
+    // A lag frame is one in which the game never read the controllers
+    // ($4016/$4017), e.g. because its logic overran. LagFrame() refers to
+    // the last clockFrame(); frames start at scanline 0, so each one spans
+    // exactly one NMI. Both are part of save states, so frames undone by
+    // run-ahead or rewind are not counted.
+    bool LagFrame() const { return bLagFrame; }
+    uint64_t LagFrameCount() const { return nLagFrames; }
+
     // Controller State
     uint8_t controller[2]; 
 
+    // Save states: a versioned, section tagged binary snapshot of the whole
+    // machine written into a caller provided buffer. saveState returns the
+    // number of bytes used, or 0 if the buffer is too small. loadState
+    // checks the whole snapshot first and leaves the machine untouched when
+    // it returns false.
+    size_t saveState(uint8_t* buffer, size_t size);
+    bool loadState(const uint8_t* data, size_t size);
+
+#ifdef NES_PERF_COUNTERS
+    // Counters of the frame in progress; clockFrame() clears them when a
+    // frame starts and publishes them through FrameCounters() when it ends
+    PerfCounters perf;
+    const PerfCounters& FrameCounters() const { return perfFrame; }
+#endif
+
+#ifdef NES_HEATMAP
+    // Count accesses per address in the CPU and PPU spaces, nullptr stops.
+    // Clones start without a heatmap.
+    void attachHeatmap(Heatmap* h);
+#endif
+
+    // Record NMIs, OAM DMA and sprite 0 hits as instant events, nullptr
+    // stops. Clones start without a trace.
+    void attachTrace(Trace* t);
+
+    // Audio output, resampled from the APU at the CPU clock rate
+    void setAudioSampleRate(double rate);
+    void setAudioOutput(bool enable);
+    bool AudioOutput() const { return bAudioOutput; }
+    OutputBuffer<float> audioBuffer;
+
 private:
+#ifdef NES_PERF_COUNTERS
+    PerfCounters perfFrame;
+    bool bTimedClock = false;   // Whether clock() is sampling host time
+#endif
+
+    // Save state sections; section is an index into the table in Bus.cpp
+    void saveSection(StateWriter& state, int section, uint16_t version);
+    void saveBusState(StateWriter& state, uint16_t version);
+    void loadBusState(StateReader& state, uint16_t version);
+
+    // Copies share the cartridge and leave the screen and audio buffers
+    // behind, only clone() uses it
+    Bus(const Bus&) = default;
+    Bus& operator=(const Bus&) = delete;
+
+    Trace* trace = nullptr;
+#ifdef NES_HEATMAP
+    Heatmap* heatmap = nullptr;
+#endif
     uint32_t nSystemClockCounter = 0;
+    double dAudioTime = 0.0;
+    double dCpuCyclesPerSample = 1789773.0 / 44100.0;
+    bool bAudioOutput = true;
+    bool bInputRead = false;
+    bool bLagFrame = false;
+    uint64_t nLagFrames = 0;
     uint8_t controller_state[2];
 };
@@ -1,9 +1,13 @@
 #pragma once
 #include <cstdint>
 #include <string>
-#include <vector>
 
 class Bus;
+class Profiler;
+class InstructionTrace;
+class Heatmap;
+class StateWriter;
+class StateReader;
 
 class CPU {
 public:
@@ -19,6 +23,32 @@ public:
     void irq();
     void nmi();
 
+    // Save states. Version 2 added the cycle count; saveState writes the
+    // layout of the given version.
+    void saveState(StateWriter& state, uint16_t version = 2);
+    bool loadState(StateReader& state, uint16_t version);
+
+    // Text of the instruction whose bytes (up to 3) start at addr, e.g.
+    // "LDA $0200,X". nLength receives the instruction size.
+    static std::string disassemble(uint16_t addr, const uint8_t* bytes, uint8_t& nLength);
+
+#ifdef NES_PROFILER
+    // Every executed instruction and interrupt is reported to the profiler
+    void attachProfiler(Profiler* p) { profiler = p; }
+#endif
+
+#ifdef NES_HEATMAP
+    // Instructions are counted by opcode address, the bus counts the rest
+    void attachHeatmap(Heatmap* h) { heatmap = h; }
+#endif
+
+    // Record every instruction with the machine state before it, nullptr
+    // stops. Clones start without a trace.
+    void attachInstructionTrace(InstructionTrace* t) { instructionTrace = t; }
+
+    // Cycles clocked since power on, restored with save states
+    uint64_t CycleCount() const { return nCycleCount; }
+
     // Public for debug
     uint8_t  a = 0x00;      // Accumulator
     uint8_t  x = 0x00;      // X Register
@@ -30,6 +60,16 @@ public:
     
 private:
     Bus* bus = nullptr;
+#ifdef NES_PROFILER
+    Profiler* profiler = nullptr;
+#endif
+#ifdef NES_HEATMAP
+    Heatmap* heatmap = nullptr;
+#endif
+    InstructionTrace* instructionTrace = nullptr;
+    uint64_t nCycleCount = 0;
+    void traceInstruction();
+
     uint8_t read(uint16_t a);
     void write(uint16_t a, uint8_t d);
     uint8_t fetch();
@@ -81,11 +121,11 @@ private:
     uint8_t XXX();
 
     struct INSTRUCTION {
-        std::string name;
-        uint8_t(CPU::*operate)(void) = nullptr;
-        uint8_t(CPU::*addrmode)(void) = nullptr;
-        uint8_t cycles = 0;
+        const char* name;
+        uint8_t(CPU::*operate)(void);
+        uint8_t(CPU::*addrmode)(void);
+        uint8_t cycles;
     };
 
-    std::vector<INSTRUCTION> lookup;
+    static const INSTRUCTION lookup[256];
 };
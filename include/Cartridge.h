@@ -3,12 +3,22 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include "RomImage.h"
+
+class StateWriter;
+class StateReader;
 
 class Cartridge {
 public:
+    // The ROM file is shared through RomImage::open(), so cartridges of the
+    // same game hold only their own CHR-RAM and PRG-RAM
     Cartridge(const std::string& sFileName);
+    Cartridge(std::shared_ptr<const RomImage> image);
     ~Cartridge();
 
+    // Copy sharing the ROM image, with its own CHR-RAM and PRG-RAM
+    std::shared_ptr<Cartridge> clone() const;
+
     // Communication with Main Bus
     bool cpuRead(uint16_t addr, uint8_t &data);
     bool cpuWrite(uint16_t addr, uint8_t data);
@@ -18,6 +28,17 @@ public:
     bool ppuWrite(uint16_t addr, uint8_t data);
     
     bool ImageValid();
+
+    // Fingerprint of the PRG and CHR ROM contents
+    uint64_t RomHash();
+
+    uint8_t MapperID();
+    uint8_t PRGBanks();
+    uint8_t CHRBanks();
+
+    // Save states hold only the writable parts (CHR-RAM, PRG-RAM, banks)
+    void saveState(StateWriter& state);
+    bool loadState(StateReader& state, uint16_t version);
     
     enum MIRROR {
         HORIZONTAL,
@@ -28,13 +49,49 @@ public:
     
     MIRROR Mirror();
 
+    // NSF music files are loaded as a cartridge with the NSF bank
+    // switching scheme and 8KB of work RAM at $6000-$7FFF
+    bool IsNSF();
+    void resetNSF();
+
+    struct NSFInfo {
+        uint8_t nSongs = 0;
+        uint8_t nStartSong = 1;
+        uint16_t nLoadAddr = 0x0000;
+        uint16_t nInitAddr = 0x0000;
+        uint16_t nPlayAddr = 0x0000;
+        uint16_t nSpeedNTSC = 16639; // Microseconds between PLAY calls
+        uint8_t nExtraChips = 0;
+        std::string sTitle;
+        std::string sArtist;
+        std::string sCopyright;
+    } nsf;
+
 private:
-    std::vector<uint8_t> vPRGMemory;
-    std::vector<uint8_t> vCHRMemory;
+    // Plain copies would point into the original's RAM, see clone()
+    Cartridge(const Cartridge&) = default;
+    Cartridge& operator=(const Cartridge&) = delete;
+
+    void loadNSF(const uint8_t* data, size_t size);
+
+    std::shared_ptr<const RomImage> rom;
+    const uint8_t* pPRGMemory = nullptr;
+    size_t nPRGMemorySize = 0;
+    const uint8_t* pCHRMemory = nullptr;  // CHR ROM in the image, or vCHRRam
+
+    std::vector<uint8_t> vCHRRam;
+    std::vector<uint8_t> vPRGRam;
+    std::vector<uint8_t> vNSFMemory;      // Bank aligned copy of the NSF data
+
+    bool bNSF = false;
+    bool bNSFBankSwitched = false;
+    uint8_t nNSFBankInit[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+    uint8_t nNSFBank[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
 
     uint8_t nMapperID = 0;
     uint8_t nPRGBanks = 0;
     uint8_t nCHRBanks = 0;
     
     bool bImageValid = false;
+    uint64_t nRomHash = 0;
 };
@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <chrono>
+#include <functional>
+
+// Paces the frontend at the NES frame rate using the audio device as the
+// clock: a frame is emulated whenever the queued audio has drained to the
+// target latency. The target grows after an underrun and slowly shrinks back
+// while playback is stable. When presentation is locked to vsync instead,
+// the emulated audio sample rate is nudged so the queue stays at the target.
+class FramePacer {
+public:
+    enum class Mode { AUDIO, VSYNC };
+
+    // queuedSamples reports the number of samples waiting in the audio queue
+    FramePacer(double sampleRate, uint32_t deviceSamples, std::function<uint32_t()> queuedSamples);
+
+    void setMode(Mode m);
+    Mode GetMode() const { return mode; }
+
+    // Call before emulating a frame
+    void beginFrame();
+    // Call just before the frame's audio is queued
+    void audioQueued();
+    // Call after presenting, waits for the audio clock in AUDIO mode
+    void endFrame();
+
+    // Sample rate the APU output should be resampled to for this frame
+    double AudioSampleRate() const { return dAudioRate; }
+    // Maximum samples to keep queued, anything beyond is dropped
+    uint32_t MaxQueuedSamples() const;
+
+    struct Stats {
+        double fps = 0.0;
+        double frameTimeAvgMs = 0.0;    // Host time spent per frame, excluding the wait
+        double frameTimeMaxMs = 0.0;
+        double audioLatencyMs = 0.0;    // Queued plus device buffered audio
+        double targetLatencyMs = 0.0;
+        double rateAdjust = 1.0;
+        uint32_t underruns = 0;
+        bool updated = false;           // Set once per second when the fields are refreshed
+    };
+    Stats& GetStats() { return stats; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    Mode mode = Mode::AUDIO;
+    std::function<uint32_t()> queuedSamples;
+
+    double dSampleRate;
+    double dAudioRate;
+    double dFrameSamples;
+    uint32_t nDeviceSamples;
+    double dTargetSamples;
+    uint32_t nStableFrames = 0;
+    bool bFirstFrame = true;
+
+    Clock::time_point tFrameStart;
+    Clock::time_point tWindowStart;
+    uint32_t nWindowFrames = 0;
+    double dWindowWorkMs = 0.0;
+    double dWindowMaxMs = 0.0;
+    double dWindowLatencyMs = 0.0;
+
+    Stats stats;
+};
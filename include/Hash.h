@@ -0,0 +1,9 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// 64 bit non-cryptographic hash following the xxHash64 algorithm, used for
+// ROM identification and state/framebuffer fingerprints
+namespace Hash {
+    uint64_t hash64(const void* data, size_t n, uint64_t seed = 0);
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Per address access counts for the CPU address space (reads, writes and
+// instructions executed, by opcode address) and the PPU address space
+// (reads and writes, including the PPU's own rendering fetches). The bus
+// and PPU only report to it when built with NES_HEATMAP
+// (cmake -DNES_HEATMAP=ON); otherwise the hooks are not compiled in.
+class Heatmap {
+public:
+    enum Access { READ, WRITE, EXECUTE, ACCESS_COUNT };
+
+    Heatmap();
+
+    void cpu(Access k, uint16_t addr) { vCpu[k][addr]++; }
+    void ppu(Access k, uint16_t addr) { vPpu[k][addr & 0x3FFF]++; }
+    // Called by the bus at the end of every frame, for per frame averages
+    void endFrame() { nFrames++; }
+
+    void clear();
+    uint64_t Frames() const { return nFrames; }
+
+    // One row per address that was accessed: space, address, the counts and
+    // the counts per frame
+    void writeCSV(std::ostream& os) const;
+
+    // Images with one pixel per address, rows of 256 addresses for the CPU
+    // space and of 128 for the PPU space, scaled up to 512x512. Brightness is
+    // logarithmic in the count; red is writes, green reads, blue executes.
+    bool writeCpuPNG(const std::string& sFileName) const;
+    bool writePpuPNG(const std::string& sFileName) const;
+
+private:
+    bool writePNG(const std::string& sFileName, const std::vector<uint64_t>* counts, int nWidth, int nHeight, int nScale) const;
+
+    std::vector<uint64_t> vCpu[ACCESS_COUNT];
+    std::vector<uint64_t> vPpu[ACCESS_COUNT];
+    uint64_t nFrames = 0;
+};
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// HDR style histogram of 64 bit values (e.g. nanoseconds): exact below 128,
+// then 64 buckets per power of two, so every recorded value and percentile
+// is within 1/64 (1.6%) of the true value at any magnitude. Recording is a
+// couple of shifts and an increment; memory is fixed at about 30KB.
+class Histogram {
+public:
+    Histogram();
+
+    void record(uint64_t value);
+    void clear();
+
+    uint64_t Count() const { return nCount; }
+    uint64_t Min() const { return nCount ? nMin : 0; }
+    uint64_t Max() const { return nMax; }
+
+    // Value at or below which p percent (0-100) of the recorded values lie,
+    // reported as the upper end of its bucket
+    uint64_t percentile(double p) const;
+
+private:
+    static const int SUB_BITS = 7;
+
+    static size_t index(uint64_t value);
+    static uint64_t upperBound(size_t index);
+
+    std::vector<uint64_t> vBuckets;
+    uint64_t nCount = 0;
+    uint64_t nMin = UINT64_MAX;
+    uint64_t nMax = 0;
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Per-instruction CPU trace. The CPU fills one fixed size record per
+// instruction into a single producer, single consumer ring buffer; a writer
+// thread drains it to a binary file. Neither side takes a lock, and the CPU
+// only waits if the writer falls a whole ring behind, so a trace is always
+// complete. nes_tracedump turns the file into nestest style text.
+class InstructionTrace {
+public:
+    // Machine state before the instruction executes
+    struct Record {
+        uint64_t nCycle;        // CPU cycles since power on
+        uint16_t pc;
+        int16_t scanline;       // PPU position, -1 is the pre-render line
+        uint16_t dot;
+        uint8_t bytes[3];       // Opcode and operands, as many as it uses
+        uint8_t a, x, y, status, stkp;
+    };
+    static_assert(sizeof(Record) == 24, "trace records are written as is");
+
+    // File layout: "NCTR", version, record size (uint32 each), then records
+    static const uint32_t VERSION = 1;
+
+    InstructionTrace();
+    ~InstructionTrace();
+
+    bool open(const std::string& sFileName);
+    // Waits for the writer to empty the ring and closes the file
+    void close();
+    bool IsOpen() const { return file != nullptr; }
+
+    void record(const Record& r) {
+        uint64_t head = nHead.load(std::memory_order_relaxed);
+        while (head - nTail.load(std::memory_order_acquire) >= RING_RECORDS) std::this_thread::yield();
+        vRing[head & (RING_RECORDS - 1)] = r;
+        nHead.store(head + 1, std::memory_order_release);
+    }
+
+    uint64_t RecordCount() const { return nHead.load(std::memory_order_relaxed); }
+
+private:
+    static const size_t RING_RECORDS = 1 << 16;
+
+    void writer();
+
+    FILE* file = nullptr;
+    std::vector<Record> vRing;
+    // The producer and the consumer index live on separate cache lines
+    alignas(64) std::atomic<uint64_t> nHead{0};
+    alignas(64) std::atomic<uint64_t> nTail{0};
+    std::atomic<bool> bStop{false};
+    std::thread thread;
+};
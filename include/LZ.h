@@ -0,0 +1,15 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// Small LZ77 byte codec in the spirit of LZ4, used for rewind snapshots.
+// Each sequence is a token (literal count << 4 | match length - 4), optional
+// length extension bytes, the literals, and a 16 bit match offset.
+namespace LZ {
+    // Worst case output size for n input bytes
+    size_t MaxCompressedSize(size_t n);
+
+    // Return the number of bytes written, or 0 if dst is too small
+    size_t compress(const uint8_t* src, size_t n, uint8_t* dst, size_t capacity);
+    size_t decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t capacity);
+}
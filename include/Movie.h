@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Bus;
+
+// Deterministic input movies: the controller bytes of every frame together
+// with the ROM hash and periodic save state keyframes, so playback can start
+// from any frame by loading the nearest keyframe and emulating forward.
+//
+//   "NMOV" | u16 version | u16 flags | u64 ROM hash | u32 frames | u32 keyframe interval
+//   chunks: "STAT" | u32 frame | u32 size | save state
+//           "INPT" | u32 first frame | u32 count | count * (pad 1, pad 2)
+//   index:  "INDX" | u32 count | count * (u32 frame, u64 file offset of STAT)
+//   trailer: u64 index offset | "NMVI"
+//
+// Only the index and input are read by load(), keyframes are read from the
+// file when seeking. Version 1 files (a single start state followed by the
+// input) and raw input files (2 bytes per frame, power on start) also load.
+class Movie {
+public:
+    Movie(uint32_t nKeyframeInterval = 300);
+
+    // Recording: call record() once per frame after the controllers are set
+    // and before the frame is emulated
+    void startRecording(Bus& bus);
+    void record(Bus& bus);
+    bool save(const std::string& sFileName);
+
+    // Playback: start() restores the starting state, nextFrame() sets the
+    // controllers for the next frame and returns false once the movie ends
+    bool load(const std::string& sFileName);
+    bool start(Bus& bus);
+    bool nextFrame(Bus& bus);
+
+    // Put the machine at the start of frame nTarget. Returns the number of
+    // frames that had to be emulated from the nearest keyframe, or -1. The
+    // fast forward runs without output; the caller's settings are kept.
+    long seek(Bus& bus, uint32_t nTarget);
+
+    uint32_t FrameCount() const { return (uint32_t)(vInput.size() / 2); }
+    uint32_t CurrentFrame() const { return nFrame; }
+    bool Finished() const { return nFrame >= FrameCount(); }
+
+private:
+    struct Keyframe {
+        uint32_t nFrame = 0;
+        uint64_t nOffset = 0;           // STAT chunk in sFileName, if not in memory
+        std::vector<uint8_t> vState;
+    };
+
+    bool loadVersion1(const std::vector<uint8_t>& data);
+    bool readKeyframe(Keyframe& key);
+    bool restore(Bus& bus, Keyframe& key);
+
+    std::string sFileName;
+    uint64_t nRomHash = 0;
+    uint32_t nKeyframeInterval;
+    std::vector<Keyframe> vKeyframes;
+    std::vector<uint8_t> vInput;
+    uint32_t nFrame = 0;
+};
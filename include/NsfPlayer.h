@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+
+class Bus;
+
+// Plays NSF tunes by calling their INIT and PLAY routines directly on the
+// CPU. Only the CPU and APU are clocked, the PPU is never touched.
+class NsfPlayer {
+public:
+    NsfPlayer(Bus* bus);
+
+    // Initialise a song (1 based, as numbered in the NSF header)
+    void startTrack(uint8_t track);
+
+    // Advance playback by a number of CPU cycles
+    void run(uint32_t nCycles);
+
+private:
+    void call(uint16_t addr);
+    bool idle();
+
+    Bus* bus = nullptr;
+    double dPlayPeriod = 0.0;   // CPU cycles between PLAY calls
+    double dPlayCounter = 0.0;
+    bool bPlayPending = false;
+};
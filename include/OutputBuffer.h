@@ -0,0 +1,15 @@
+#pragma once
+#include <vector>
+
+// A vector that stays behind when the object holding it is copied: copies
+// start empty. Used for the screen and the audio samples, which belong to
+// one machine, so Bus::clone() does not copy buffers it would discard.
+template<typename T>
+class OutputBuffer : public std::vector<T> {
+public:
+    OutputBuffer() = default;
+    OutputBuffer(const OutputBuffer&) : std::vector<T>() {}
+    OutputBuffer(OutputBuffer&&) = default;
+    OutputBuffer& operator=(const OutputBuffer&) { this->clear(); return *this; }
+    OutputBuffer& operator=(OutputBuffer&&) = default;
+};
@@ -1,9 +1,15 @@
 #pragma once
 #include <cstdint>
 #include <memory>
-#include <array>
+#include <vector>
+#include "OutputBuffer.h"
 
 class Cartridge;
+class Trace;
+class Heatmap;
+struct PerfCounters;
+class StateWriter;
+class StateReader;
 
 class PPU {
 public:
@@ -21,8 +27,50 @@ public:
     // Interface
     void ConnectCartridge(const std::shared_ptr<Cartridge>& cart);
     void clock();
+
+    // 256x240 ARGB framebuffer. It is allocated when first drawn to or asked
+    // for, so instances that run without video output never carry one.
     uint32_t* GetScreen();
 
+    // Frames emulated with video output disabled still run the full
+    // rendering pipeline (sprite 0 hits etc.) but leave the screen untouched
+    void setVideoOutput(bool enable);
+    bool VideoOutput() const { return bVideoOutput; }
+
+    // Draw into a caller owned 256x240 image instead of GetScreen(), e.g. a
+    // locked streaming texture or shared memory. Rows are nPitch bytes apart.
+    // INDEX8 writes NES colour numbers (0-63) that GetPalette() maps to ARGB.
+    // The target can change between frames; nullptr returns to GetScreen().
+    enum class PixelFormat {
+        ARGB8888,
+        INDEX8,
+    };
+    void setRenderTarget(void* pixels, int nPitch, PixelFormat format = PixelFormat::ARGB8888);
+    const uint32_t* GetPalette();
+
+    // One flag per row (0-239), set when a drawn row differs from the last
+    // time it was drawn, so frontends can upload only the rows that changed.
+    // Flags accumulate until clearDirtyRows(); a new render target marks
+    // every row dirty.
+    const bool* DirtyRows() const { return bRowDirty; }
+    void clearDirtyRows();
+
+    // Sprite 0 hits are recorded as instant events while a trace is attached
+    void attachTrace(Trace* t) { trace = t; }
+
+    // Scanline being drawn, -1 for the pre-render line, and the dot on it
+    int16_t Scanline() const { return scanline; }
+    int16_t Cycle() const { return cycle; }
+
+#ifdef NES_HEATMAP
+    void attachHeatmap(Heatmap* h) { heatmap = h; }
+#endif
+
+#ifdef NES_PERF_COUNTERS
+    // Sprite evaluations are counted into the owning bus's counters
+    void attachPerfCounters(PerfCounters* p) { perf = p; }
+#endif
+
     // Public OAM Access for DMA
     void setOAMAddress(uint8_t addr);
     void writeOAMData(uint8_t data);
@@ -30,12 +78,32 @@ public:
     // Status Flags
     bool nmi = false;
 
+    // Save states (the framebuffer is output only and not included)
+    void saveState(StateWriter& state);
+    bool loadState(StateReader& state, uint16_t version);
+
 private:
     std::shared_ptr<Cartridge> cart;
+    Trace* trace = nullptr;
+#ifdef NES_HEATMAP
+    Heatmap* heatmap = nullptr;
+#endif
+#ifdef NES_PERF_COUNTERS
+    PerfCounters* perf = nullptr;
+#endif
 
     // Visuals
-    uint32_t sprScreen[256 * 240];
-    std::array<uint32_t, 64> palScreen;
+    OutputBuffer<uint32_t> sprScreen;   // Allocated when first drawn to
+    void allocateScreen();
+    bool bVideoOutput = true;
+    uint8_t* pTarget = nullptr;
+    int nTargetPitch = 0;
+    PixelFormat eTargetFormat = PixelFormat::ARGB8888;
+
+    // Per row hash of the colour numbers drawn, for dirty row tracking
+    uint64_t nRowHash = 0;
+    uint64_t nPrevRowHash[240] = {};
+    bool bRowDirty[240] = {};
 
     // Memory
     uint8_t tblName[2][1024]; // VRAM (2kB)
@@ -45,13 +113,6 @@ private:
     uint8_t oam[256];
     uint8_t oam_addr = 0x00;
 
-    struct sOAMEntry {
-        uint8_t y;
-        uint8_t id;
-        uint8_t attribute;
-        uint8_t x;
-    } OAM[64];
-
     // Internal Sprite Rendering State
     struct sSpriteScanline {
         uint8_t y;
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+
+// Per-frame counters of what the emulated machine did and where host time
+// went. The core only updates them when built with NES_PERF_COUNTERS
+// (cmake -DNES_PERF_COUNTERS=ON); otherwise none of the hooks exist.
+struct PerfCounters {
+    enum Region { RAM, PPU_REGS, APU_IO, CARTRIDGE, OPEN_BUS, REGION_COUNT };
+    enum Component { CPU, PPU, APU, COMPONENT_COUNT };
+
+    // Host time is sampled on one system clock in HOST_SAMPLE_INTERVAL and
+    // scaled up, timing every clock would cost more than the clock itself
+    static const uint32_t HOST_SAMPLE_INTERVAL = 256;
+
+    uint64_t nInstructions = 0;
+    uint64_t nCpuCycles = 0;
+    uint64_t nReads[REGION_COUNT] = {};
+    uint64_t nWrites[REGION_COUNT] = {};
+    uint32_t nPpuWritesPerScanline[262] = {};  // Index 0 is the pre-render line
+    uint64_t nSpriteEvaluations = 0;
+    uint64_t nSpritesFound = 0;
+    uint64_t nAudioSamples = 0;
+    uint64_t nHostNs[COMPONENT_COUNT] = {};     // Estimated from the samples
+
+    void clear() { *this = PerfCounters(); }
+    void print(std::ostream& os) const;
+};
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+class Bus;
+
+// 6502 profiler: a cycle histogram over all 65536 PCs plus self cycles per
+// routine, where a routine is the target of a JSR (or an interrupt handler)
+// tracked with a shadow call stack. The CPU only reports to it when built
+// with NES_PROFILER (cmake -DNES_PROFILER=ON); otherwise the hooks are not
+// compiled in and cost nothing.
+class Profiler {
+public:
+    Profiler();
+
+    // Start a new profile, attributing cycles to the routine at nEntry until
+    // the first call
+    void reset(uint16_t nEntry);
+
+    // Called by the CPU for every executed instruction. nTarget is the
+    // address a JSR or BRK transfers control to.
+    void instruction(uint16_t pc, uint8_t opcode, uint8_t nCycles, uint16_t nTarget) {
+        vPCCycles[pc] += nCycles;
+        vRoutineCycles[nRoutine] += nCycles;
+        nTotalCycles += nCycles;
+        if (opcode == 0x20 || opcode == 0x00) enter(nTarget);     // JSR, BRK
+        else if (opcode == 0x60 || opcode == 0x40) leave();        // RTS, RTI
+    }
+
+    // Called by the CPU when it takes an NMI or IRQ
+    void interrupt(uint16_t nHandler, uint8_t nCycles) {
+        enter(nHandler);
+        vRoutineCycles[nRoutine] += nCycles;
+        nTotalCycles += nCycles;
+    }
+
+    uint64_t TotalCycles() const { return nTotalCycles; }
+
+    // Hottest routines by self cycles with their share of the total, then an
+    // annotated disassembly of the top nAnnotate of them (code is read
+    // through the bus without side effects)
+    void report(std::ostream& os, Bus& bus, size_t nRoutines = 20, size_t nAnnotate = 5) const;
+
+private:
+    void enter(uint16_t nRoutineAddr);
+    void leave();
+
+    std::vector<uint64_t> vPCCycles;
+    std::vector<uint64_t> vRoutineCycles;
+    std::vector<uint32_t> vRoutineCalls;
+    std::vector<uint16_t> vStack;
+    uint16_t nRoutine = 0;
+    uint16_t nEntry = 0;
+    uint64_t nTotalCycles = 0;
+};
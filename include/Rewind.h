@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+class Bus;
+
+// Frame by frame rewind history kept in a fixed size ring buffer. Every
+// nKeyframeInterval frames a full snapshot is stored; the frames between are
+// stored as the XOR of their snapshot against that keyframe. Both are LZ
+// compressed, so mostly unchanged state costs only a few bytes per frame.
+// When the buffer is full the oldest keyframe and its deltas are dropped.
+class Rewind {
+public:
+    Rewind(size_t nCapacityBytes = 8 * 1024 * 1024, uint32_t nKeyframeInterval = 60);
+
+    // Capture the current machine state
+    bool push(Bus& bus);
+    // Restore the most recent capture and remove it from the history
+    bool pop(Bus& bus);
+
+    void clear();
+    size_t Frames() const { return nCount; }
+    size_t BytesUsed() const { return nBytesUsed; }
+
+private:
+    struct Entry {
+        size_t offset = 0;
+        uint32_t size = 0;
+        uint64_t nKeySeq = 0;   // Sequence number of the keyframe this entry depends on
+        bool bKeyframe = false;
+    };
+
+    Entry& entry(uint64_t seq) { return vEntries[seq % vEntries.size()]; }
+    size_t reserve(size_t nBytes);
+    void evictOldest();
+    bool loadKeyframe(uint64_t seq);
+
+    std::vector<uint8_t> vRing;
+    std::vector<Entry> vEntries;
+    uint64_t nFirstSeq = 0;     // Oldest entry
+    uint64_t nCount = 0;
+    size_t nWritePos = 0;
+    size_t nBytesUsed = 0;
+
+    uint32_t nKeyframeInterval;
+    uint32_t nSinceKeyframe = 0;
+
+    // Uncompressed snapshot of the keyframe the next delta refers to
+    std::vector<uint8_t> vKeyframe;
+    uint64_t nKeyframeSeq = UINT64_MAX;
+
+    std::vector<uint8_t> vState;
+    size_t nStateSize = 0;
+};
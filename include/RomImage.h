@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Read only contents of a ROM file, memory mapped where the platform allows.
+// Cartridges point into the image instead of copying PRG and CHR ROM, so
+// every instance of a game shares one copy. open() keeps one image per path
+// for as long as any cartridge still uses it.
+class RomImage {
+public:
+    ~RomImage();
+    RomImage(const RomImage&) = delete;
+    RomImage& operator=(const RomImage&) = delete;
+
+    // Shared image of a file, loaded on first use. nullptr if unreadable.
+    static std::shared_ptr<const RomImage> open(const std::string& sFileName);
+    // Private image of a file, bypassing the cache
+    static std::shared_ptr<const RomImage> load(const std::string& sFileName);
+    // Image of ROM data already in memory (generated ROMs, tests)
+    static std::shared_ptr<const RomImage> fromMemory(std::vector<uint8_t> vData);
+
+    const uint8_t* Data() const { return pData; }
+    size_t Size() const { return nSize; }
+
+private:
+    RomImage() = default;
+
+    const uint8_t* pData = nullptr;
+    size_t nSize = 0;
+    void* pMapping = nullptr;       // mmap()ed file, or nullptr if held in vData
+    std::vector<uint8_t> vData;
+};
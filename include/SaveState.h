@@ -0,0 +1,108 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Save state blobs are a small header followed by tagged sections:
+//
+//   "NSTA" | u32 format version | u32 total size
+//   tag[4] | u16 section version | u32 payload size | payload ...
+//
+// Values are stored little endian in host layout using plain memcpy, so
+// saving and loading never allocate. Unknown sections are skipped on load.
+// Components check that their whole payload is present before they change
+// anything, so a failed load leaves them as they were.
+
+const uint32_t SAVESTATE_VERSION = 1;
+
+class StateWriter {
+public:
+    // A writer without a buffer only measures: Size() is what would be written
+    StateWriter(uint8_t* buffer, size_t size) : pBuffer(buffer), nSize(size) {}
+
+    void beginSection(const char tag[4], uint16_t version) {
+        writeBytes(tag, 4);
+        write(version);
+        nSectionStart = nPos;
+        write((uint32_t)0);
+    }
+
+    void endSection() {
+        if (bOverflow || !pBuffer) return;
+        uint32_t length = (uint32_t)(nPos - nSectionStart - sizeof(uint32_t));
+        memcpy(pBuffer + nSectionStart, &length, sizeof(length));
+    }
+
+    template<typename T>
+    void write(const T& v) {
+        static_assert(std::is_trivially_copyable<T>::value, "state values must be trivially copyable");
+        writeBytes(&v, sizeof(T));
+    }
+
+    void writeBytes(const void* data, size_t n) {
+        if (!pBuffer) { nPos += n; return; }
+        if (bOverflow || nPos + n > nSize) { bOverflow = true; return; }
+        memcpy(pBuffer + nPos, data, n);
+        nPos += n;
+    }
+
+    // Overwrite previously written bytes, used for header fields
+    void patch(size_t offset, const void* data, size_t n) {
+        if (pBuffer && !bOverflow && offset + n <= nPos) memcpy(pBuffer + offset, data, n);
+    }
+
+    bool Overflow() const { return bOverflow; }
+    size_t Size() const { return nPos; }
+
+private:
+    uint8_t* pBuffer;
+    size_t nSize;
+    size_t nPos = 0;
+    size_t nSectionStart = 0;
+    bool bOverflow = false;
+};
+
+class StateReader {
+public:
+    StateReader(const uint8_t* data, size_t size) : pData(data), nSize(size) {}
+
+    template<typename T>
+    void read(T& v) {
+        static_assert(std::is_trivially_copyable<T>::value, "state values must be trivially copyable");
+        readBytes(&v, sizeof(T));
+    }
+
+    void read(bool& v) {
+        uint8_t b = 0;
+        readBytes(&b, 1);
+        v = b != 0;
+    }
+
+    void readBytes(void* data, size_t n) {
+        if (bError || nPos + n > nSize) { bError = true; return; }
+        memcpy(data, pData + nPos, n);
+        nPos += n;
+    }
+
+    void skip(size_t n) {
+        if (bError || nPos + n > nSize) { bError = true; return; }
+        nPos += n;
+    }
+
+    bool Error() const { return bError; }
+    size_t Remaining() const { return nSize - nPos; }
+
+private:
+    const uint8_t* pData;
+    size_t nSize;
+    size_t nPos = 0;
+    bool bError = false;
+};
+
+// Number of bytes obj.saveState() writes
+template<typename T>
+size_t stateSize(T& obj) {
+    StateWriter measure(nullptr, 0);
+    obj.saveState(measure);
+    return measure.Size();
+}
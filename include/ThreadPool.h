@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work stealing thread pool. Each worker owns a task queue: tasks submitted
+// from outside are spread round robin, tasks submitted by a running task go
+// to its own worker. A worker takes the newest task of its own queue and,
+// when that is empty, steals the oldest task of another worker, so long and
+// short jobs even out across cores without a single contended queue.
+class ThreadPool {
+public:
+    // nThreads = 0 uses one worker per hardware thread
+    explicit ThreadPool(unsigned nThreads = 0);
+    ~ThreadPool();
+
+    void submit(std::function<void()> task);
+
+    // Block until every submitted task has finished
+    void wait();
+
+    unsigned ThreadCount() const { return (unsigned)vThreads.size(); }
+
+private:
+    struct Queue {
+        std::mutex mtx;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void worker(unsigned index);
+    bool take(unsigned index, std::function<void()>& task);
+
+    std::vector<std::unique_ptr<Queue>> vQueues;
+    std::vector<std::thread> vThreads;
+
+    std::mutex mtxState;
+    std::condition_variable cvWork;
+    std::condition_variable cvDone;
+    std::atomic<long> nQueued{ 0 };     // Tasks waiting in a queue
+    std::atomic<size_t> nPending{ 0 };  // Tasks submitted but not finished
+    std::atomic<unsigned> nNextQueue{ 0 };
+    bool bStop = false;
+};
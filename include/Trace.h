@@ -0,0 +1,75 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Chrome/Perfetto trace-event recorder; open the file in ui.perfetto.dev or
+// chrome://tracing. Events are appended to an in-memory block by the
+// emulation thread and full blocks are formatted and written by a background
+// thread, so tracing does not stall the frames it measures. Event names are
+// not copied and must be string literals.
+class Trace {
+public:
+    Trace() = default;
+    ~Trace();
+
+    bool open(const std::string& sFileName);
+    // Writes the remaining events and completes the JSON
+    void close();
+    bool IsOpen() const { return file != nullptr; }
+
+    // Zero length event, e.g. an NMI or a sprite 0 hit
+    void instant(const char* name) { push(name, 'i', now(), 0); }
+
+    // Duration event covering the lifetime of the object. A null trace makes
+    // it a no-op, so spans can stay in place when tracing is off.
+    class Span {
+    public:
+        Span(Trace* t, const char* name) : trace(t), sName(name) { if (trace) nStart = trace->now(); }
+        ~Span() { if (trace) trace->push(sName, 'X', nStart, trace->now() - nStart); }
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+    private:
+        Trace* trace;
+        const char* sName;
+        uint64_t nStart = 0;
+    };
+
+private:
+    struct Event {
+        const char* name;
+        char phase;
+        uint64_t nStart;    // ns since open()
+        uint64_t nDuration;
+    };
+
+    uint64_t now() const {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - tOpen).count();
+    }
+    void push(const char* name, char phase, uint64_t nStart, uint64_t nDuration) {
+        if (!file) return;
+        vBlock.push_back({ name, phase, nStart, nDuration });
+        if (vBlock.size() == BLOCK_EVENTS) submit();
+    }
+    void submit();
+    void writer();
+
+    static const size_t BLOCK_EVENTS = 4096;
+
+    FILE* file = nullptr;
+    std::chrono::steady_clock::time_point tOpen;
+    std::vector<Event> vBlock;
+
+    // Blocks handed to the writer thread
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<std::vector<Event>> qPending;
+    bool bStop = false;
+    std::thread thread;
+};
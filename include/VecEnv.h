@@ -0,0 +1,60 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ThreadPool.h"
+
+class Bus;
+
+// N independent instances of one ROM stepped together, for reinforcement
+// learning style workloads. Observations are written straight into caller
+// owned contiguous arrays: the PPU of instance i draws its colour numbers
+// into frames + i * 256 * 240 and its RAM is copied to ram + i * 2048 after
+// each step. Stepping is spread across the worker threads as one prebuilt
+// task per worker, so no closures are created per step.
+class VecEnv {
+public:
+    VecEnv(const std::string& sRomFile, size_t nEnvs, unsigned nThreads = 0);
+    ~VecEnv();
+
+    bool IsValid() const { return bValid; }
+    size_t Size() const { return vEnvs.size(); }
+
+    // Either array may be nullptr. frames holds nEnvs * 256 * 240 NES colour
+    // numbers (0-63, map with Palette()), ram holds nEnvs * 2048 bytes.
+    void setObservationBuffers(uint8_t* pFrames, uint8_t* pRam);
+
+    // Restore the power on state; observations follow on the next step.
+    // Returns false if it could not be restored, leaving the instance as is.
+    bool reset();
+    bool reset(size_t index);
+
+    // Run nFrames frames on every instance with pInput[i] held on controller 1
+    // of instance i. Only the last frame is drawn into the observation.
+    void step(const uint8_t* pInput, uint32_t nFrames = 1);
+
+    Bus& Env(size_t index) { return *vEnvs[index]; }
+    const uint32_t* Palette();
+
+private:
+    void stepRange(size_t nBegin, size_t nEnd);
+
+    std::vector<std::unique_ptr<Bus>> vEnvs;
+    std::vector<uint8_t> vStartState;
+    size_t nStartStateSize = 0;
+    bool bValid = false;
+
+    uint8_t* pFrames = nullptr;
+    uint8_t* pRam = nullptr;
+
+    // Parameters of the step in progress, read by the workers
+    const uint8_t* pStepInput = nullptr;
+    uint32_t nStepFrames = 1;
+
+    ThreadPool pool;
+    size_t nChunkSize = 1;
+    std::vector<std::function<void()>> vTasks;
+};
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Streams mono 32-bit float samples into a RIFF/WAVE file. Samples are
+// collected in a memory buffer and written out in large blocks; the header
+// sizes are patched in when the file is closed. close() reports whether
+// every write succeeded.
+class WavWriter {
+public:
+    WavWriter(const std::string& sFileName, uint32_t sampleRate);
+    ~WavWriter();
+
+    bool IsOpen();
+    void write(const float* samples, size_t count);
+    bool close();
+
+    uint64_t SampleCount() const { return nSamplesWritten; }
+
+private:
+    void flush();
+
+    std::ofstream ofs;
+    std::vector<float> buffer;
+    uint32_t nSampleRate = 44100;
+    uint64_t nSamplesWritten = 0;
+    bool bClosedOk = false;     // What close() returns once the file is closed
+};
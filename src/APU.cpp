@@ -1,7 +1,10 @@
 #include "APU.h"
+#include "SaveState.h"
 #include <cstring>
 #include <cmath>
 
+const uint8_t APU::length_table[32] = { 10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14, 12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30 };
+
 APU::APU() {
 }
 
@@ -313,3 +316,128 @@ double APU::GetOutputSample() {
     
     return output + tnd_out;
 }
+
+void APU::saveState(StateWriter& state) {
+    auto length = [&](LengthCounter& l) {
+        state.write(l.counter);
+        state.write(l.halt);
+    };
+    auto envelope = [&](Envelope& e) {
+        state.write(e.start);
+        state.write(e.disable);
+        state.write(e.divider_count);
+        state.write(e.volume);
+        state.write(e.output);
+        state.write(e.decay_count);
+    };
+    auto pulse = [&](Pulse& p) {
+        state.write(p.enabled);
+        state.write(p.timer);
+        state.write(p.timer_period);
+        state.write(p.duty_mode);
+        state.write(p.duty_value);
+        length(p.length_counter);
+        envelope(p.envelope);
+        state.write(p.sweep_enable);
+        state.write(p.sweep_down);
+        state.write(p.sweep_period);
+        state.write(p.sweep_shift);
+        state.write(p.sweep_timer);
+        state.write(p.sweep_reload);
+        state.write(p.target_period);
+        state.write(p.sweep_mute);
+        state.write(p.output);
+    };
+
+    state.write(frame_clock_counter);
+    state.write(clock_counter);
+    pulse(pulse1);
+    pulse(pulse2);
+
+    state.write(triangle.enabled);
+    state.write(triangle.timer);
+    state.write(triangle.timer_period);
+    state.write(triangle.sequence);
+    length(triangle.length_counter);
+    state.write(triangle.linear_counter_reload);
+    state.write(triangle.linear_counter);
+    state.write(triangle.linear_counter_reload_flag);
+    state.write(triangle.control_flag);
+    state.write(triangle.output);
+
+    state.write(noise.enabled);
+    state.write(noise.timer);
+    state.write(noise.timer_period);
+    state.write(noise.shift_register);
+    state.write(noise.mode);
+    length(noise.length_counter);
+    envelope(noise.envelope);
+    state.write(noise.output);
+
+    state.write(frame_counter_mode);
+    state.write(irq_inhibit);
+}
+
+bool APU::loadState(StateReader& state, uint16_t version) {
+    if (version != 1 || state.Remaining() < stateSize(*this)) return false;
+
+    auto length = [&](LengthCounter& l) {
+        state.read(l.counter);
+        state.read(l.halt);
+    };
+    auto envelope = [&](Envelope& e) {
+        state.read(e.start);
+        state.read(e.disable);
+        state.read(e.divider_count);
+        state.read(e.volume);
+        state.read(e.output);
+        state.read(e.decay_count);
+    };
+    auto pulse = [&](Pulse& p) {
+        state.read(p.enabled);
+        state.read(p.timer);
+        state.read(p.timer_period);
+        state.read(p.duty_mode);
+        state.read(p.duty_value);
+        length(p.length_counter);
+        envelope(p.envelope);
+        state.read(p.sweep_enable);
+        state.read(p.sweep_down);
+        state.read(p.sweep_period);
+        state.read(p.sweep_shift);
+        state.read(p.sweep_timer);
+        state.read(p.sweep_reload);
+        state.read(p.target_period);
+        state.read(p.sweep_mute);
+        state.read(p.output);
+    };
+
+    state.read(frame_clock_counter);
+    state.read(clock_counter);
+    pulse(pulse1);
+    pulse(pulse2);
+
+    state.read(triangle.enabled);
+    state.read(triangle.timer);
+    state.read(triangle.timer_period);
+    state.read(triangle.sequence);
+    length(triangle.length_counter);
+    state.read(triangle.linear_counter_reload);
+    state.read(triangle.linear_counter);
+    state.read(triangle.linear_counter_reload_flag);
+    state.read(triangle.control_flag);
+    state.read(triangle.output);
+
+    state.read(noise.enabled);
+    state.read(noise.timer);
+    state.read(noise.timer_period);
+    state.read(noise.shift_register);
+    state.read(noise.mode);
+    length(noise.length_counter);
+    envelope(noise.envelope);
+    state.read(noise.output);
+
+    state.read(frame_counter_mode);
+    state.read(irq_inhibit);
+    return !state.Error();
+}
@@ -1,43 +1,120 @@
 #include "Bus.h"
 #include "CPU.h"
 #include "PPU.h"
+#include "SaveState.h"
+#include "Trace.h"
+#include "Heatmap.h"
+#include <chrono>
+
+#ifdef NES_PERF_COUNTERS
+#define PERF_COUNT(counter) perf.counter++
+#define PERF_REGION(r) region = PerfCounters::r
+#define PERF_TIMED(component, statement) { HostTimer timer(bTimedClock, perf.nHostNs[PerfCounters::component]); statement; }
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    // A component clock is only a few nanoseconds, so the cost of reading
+    // the clock itself is measured once and taken off every sample
+    int64_t TimerOverheadNs() {
+        static const int64_t nOverhead = [] {
+            const int N = 1000;
+            auto t0 = Clock::now();
+            for (int i = 0; i < N - 1; i++) Clock::now();
+            auto t1 = Clock::now();
+            return (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count() / N;
+        }();
+        return nOverhead;
+    }
+
+    // Adds the host time of its scope, scaled by the sampling interval, when
+    // the clock is sampled
+    class HostTimer {
+    public:
+        HostTimer(bool bTimed, uint64_t& nTotal) : pTotal(bTimed ? &nTotal : nullptr) {
+            if (pTotal) tStart = Clock::now();
+        }
+        ~HostTimer() {
+            if (!pTotal) return;
+            int64_t ns = (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - tStart).count() - TimerOverheadNs();
+            if (ns > 0) *pTotal += (uint64_t)ns * PerfCounters::HOST_SAMPLE_INTERVAL;
+        }
+
+    private:
+        uint64_t* pTotal;
+        Clock::time_point tStart;
+    };
+}
+#else
+#define PERF_COUNT(counter)
+#define PERF_REGION(r)
+#define PERF_TIMED(component, statement) statement;
+#endif
 
 Bus::Bus() {
     // Clear RAM
     for (auto& i : cpuRam) i = 0x00;
+    controller[0] = controller[1] = 0x00;
+    controller_state[0] = controller_state[1] = 0x00;
     
     // Connect devices
-    cpu = std::make_shared<CPU>();
-    ppu = std::make_shared<PPU>();
-    apu = std::make_shared<APU>();
-    
-    cpu->ConnectBus(this);
+    cpu.ConnectBus(this);
+#ifdef NES_PERF_COUNTERS
+    ppu.attachPerfCounters(&perf);
+#endif
 }
 
 Bus::~Bus() {
 }
 
+std::unique_ptr<Bus> Bus::clone() const {
+    std::unique_ptr<Bus> copy(new Bus(*this));
+    copy->cpu.ConnectBus(copy.get());
+#ifdef NES_PERF_COUNTERS
+    copy->ppu.attachPerfCounters(&copy->perf);
+#endif
+    copy->attachTrace(nullptr);
+    copy->cpu.attachInstructionTrace(nullptr);
+#ifdef NES_HEATMAP
+    copy->attachHeatmap(nullptr);
+#endif
+    copy->ppu.setRenderTarget(nullptr, 0);
+    if (cart) copy->insertCartridge(cart->clone());
+    return copy;
+}
+
 void Bus::write(uint16_t addr, uint8_t data) {
+#ifdef NES_PERF_COUNTERS
+    if (addr >= 0x2000 && addr <= 0x3FFF) perf.nPpuWritesPerScanline[ppu.Scanline() + 1]++;
+#endif
+#ifdef NES_HEATMAP
+    if (heatmap) heatmap->cpu(Heatmap::WRITE, addr);
+#endif
     if (cart->cpuWrite(addr, data)) {
         // The cartridge handled the write
+        PERF_COUNT(nWrites[PerfCounters::CARTRIDGE]);
     }
     else if (addr >= 0x0000 && addr <= 0x1FFF) {
         // System RAM Address mirroring
         cpuRam[addr & 0x07FF] = data;
+        PERF_COUNT(nWrites[PerfCounters::RAM]);
     }
     else if (addr >= 0x2000 && addr <= 0x3FFF) {
-        ppu->cpuWrite(addr & 0x0007, data);
+        ppu.cpuWrite(addr & 0x0007, data);
+        PERF_COUNT(nWrites[PerfCounters::PPU_REGS]);
     }
     else if (addr >= 0x4000 && addr <= 0x4017) {
+        PERF_COUNT(nWrites[PerfCounters::APU_IO]);
         // APU Registers (excluding 4014 DMA and 4016/4017 controller which overlap)
         if (addr == 0x4014) {
              // DMA
+            if (trace) trace->instant("OAM DMA");
             uint8_t dma_page = data;
             uint16_t dma_addr = (uint16_t)dma_page << 8;
             
-            ppu->setOAMAddress(0x00);
+            ppu.setOAMAddress(0x00);
             for (uint16_t i = 0; i < 256; i++) {
-                ppu->writeOAMData(read(dma_addr + i));
+                ppu.writeOAMData(read(dma_addr + i));
             }
         } 
         else if (addr == 0x4016 || addr == 0x4017) {
@@ -46,62 +123,260 @@ void Bus::write(uint16_t addr, uint8_t data) {
              if (addr == 0x4016) controller_state[0] = controller[0];
              if (addr == 0x4017) {
                  controller_state[1] = controller[1]; // Usually unused
-                 apu->cpuWrite(addr, data); // Frame Counter
+                 apu.cpuWrite(addr, data); // Frame Counter
              }
         }
         else {
-             apu->cpuWrite(addr, data);
+             apu.cpuWrite(addr, data);
         }
     }
-    // Controller I/O ...
+    else {
+        PERF_COUNT(nWrites[PerfCounters::OPEN_BUS]);
+    }
 }
 
 uint8_t Bus::read(uint16_t addr, bool bReadOnly) {
     uint8_t data = 0x00;
 
+#ifdef NES_PERF_COUNTERS
+    PerfCounters::Region region = PerfCounters::OPEN_BUS;
+#endif
     if (cart->cpuRead(addr, data)) {
         // Cartridge handled the read
+        PERF_REGION(CARTRIDGE);
     }
     else if (addr >= 0x0000 && addr <= 0x1FFF) {
         // System RAM Address mirroring
         data = cpuRam[addr & 0x07FF];
+        PERF_REGION(RAM);
     }
     else if (addr >= 0x2000 && addr <= 0x3FFF) {
-        data = ppu->cpuRead(addr & 0x0007, bReadOnly);
+        data = ppu.cpuRead(addr & 0x0007, bReadOnly);
+        PERF_REGION(PPU_REGS);
     }
     else if (addr >= 0x4000 && addr <= 0x4015) {
-        data = apu->cpuRead(addr);
+        data = apu.cpuRead(addr);
+        PERF_REGION(APU_IO);
     }
     else if (addr >= 0x4016 && addr <= 0x4017) {
         data = (controller_state[addr & 0x0001] & 0x80) > 0;
-        controller_state[addr & 0x0001] <<= 1;
+        if (!bReadOnly) {
+            controller_state[addr & 0x0001] <<= 1;
+            bInputRead = true;
+        }
+        PERF_REGION(APU_IO);
     }
 
+#ifdef NES_PERF_COUNTERS
+    if (!bReadOnly) perf.nReads[region]++;
+#endif
+#ifdef NES_HEATMAP
+    if (heatmap && !bReadOnly) heatmap->cpu(Heatmap::READ, addr);
+#endif
     return data;
 }
 
 void Bus::insertCartridge(const std::shared_ptr<Cartridge>& cartridge) {
     this->cart = cartridge;
-    ppu->ConnectCartridge(cartridge);
+    ppu.ConnectCartridge(cartridge);
+}
+
+#ifdef NES_HEATMAP
+void Bus::attachHeatmap(Heatmap* h) {
+    heatmap = h;
+    cpu.attachHeatmap(h);
+    ppu.attachHeatmap(h);
+}
+#endif
+
+void Bus::attachTrace(Trace* t) {
+    trace = t;
+    ppu.attachTrace(t);
 }
 
 void Bus::reset() {
-    cpu->reset();
+    cpu.reset();
     nSystemClockCounter = 0;
 }
 
 void Bus::clock() {
-    ppu->clock();
+#ifdef NES_PERF_COUNTERS
+    // Host time is sampled on one clock in HOST_SAMPLE_INTERVAL
+    bTimedClock = nSystemClockCounter % PerfCounters::HOST_SAMPLE_INTERVAL == 0;
+#endif
+    PERF_TIMED(PPU, ppu.clock());
     
     if (nSystemClockCounter % 3 == 0) {
-        cpu->clock();
-        apu->clock();
+        clockCPU();
     }
     
-    if (ppu->nmi) {
-        ppu->nmi = false;
-        cpu->nmi();
+    if (ppu.nmi) {
+        ppu.nmi = false;
+        if (trace) trace->instant("NMI");
+        cpu.nmi();
     }
     
     nSystemClockCounter++;
-}
\ No newline at end of file
+#ifdef NES_PERF_COUNTERS
+    bTimedClock = false;
+#endif
+}
+
+void Bus::clockCPU() {
+    PERF_TIMED(CPU, cpu.clock());
+    PERF_TIMED(APU, apu.clock());
+    PERF_COUNT(nCpuCycles);
+
+    // Take an audio sample whenever enough CPU time has passed
+    dAudioTime += 1.0;
+    if (dAudioTime >= dCpuCyclesPerSample) {
+        dAudioTime -= dCpuCyclesPerSample;
+        if (bAudioOutput) audioBuffer.push_back((float)apu.GetOutputSample());
+        PERF_COUNT(nAudioSamples);
+    }
+}
+
+void Bus::clockFrame() {
+#ifdef NES_PERF_COUNTERS
+    perf.clear();
+#endif
+    for (int i = 0; i < 341 * 262; i++) {
+        clock();
+    }
+    bLagFrame = !bInputRead;
+    nLagFrames += bLagFrame;
+    bInputRead = false;
+#ifdef NES_PERF_COUNTERS
+    perfFrame = perf;
+#endif
+#ifdef NES_HEATMAP
+    if (heatmap) heatmap->endFrame();
+#endif
+}
+
+void Bus::setAudioSampleRate(double rate) {
+    dCpuCyclesPerSample = 1789773.0 / rate;
+}
+
+void Bus::setAudioOutput(bool enable) {
+    bAudioOutput = enable;
+}
+
+namespace {
+    // Sections in the order they are saved, with the oldest version that can
+    // still be loaded and the version written
+    enum Section { BUS, CPU_REGS, PPU_REGS, APU_REGS, CART, SECTION_COUNT };
+    const struct { char tag[5]; uint16_t oldest; uint16_t version; } SECTIONS[SECTION_COUNT] = {
+        { "BUS ", 1, 2 }, { "CPU ", 1, 2 }, { "PPU ", 1, 1 }, { "APU ", 1, 1 }, { "CART", 1, 1 },
+    };
+}
+
+// Version 2 added the lag frame state
+void Bus::saveBusState(StateWriter& state, uint16_t version) {
+    state.write(cpuRam);
+    state.write(controller);
+    state.write(controller_state);
+    state.write(nSystemClockCounter);
+    state.write(dAudioTime);
+    if (version < 2) return;
+    state.write(bInputRead);
+    state.write(bLagFrame);
+    state.write(nLagFrames);
+}
+
+void Bus::loadBusState(StateReader& state, uint16_t version) {
+    state.read(cpuRam);
+    state.read(controller);
+    state.read(controller_state);
+    state.read(nSystemClockCounter);
+    state.read(dAudioTime);
+    if (version < 2) return;
+    state.read(bInputRead);
+    state.read(bLagFrame);
+    state.read(nLagFrames);
+}
+
+void Bus::saveSection(StateWriter& state, int section, uint16_t version) {
+    switch (section) {
+        case BUS: saveBusState(state, version); break;
+        case CPU_REGS: cpu.saveState(state, version); break;
+        case PPU_REGS: ppu.saveState(state); break;
+        case APU_REGS: apu.saveState(state); break;
+        case CART: cart->saveState(state); break;
+    }
+}
+
+size_t Bus::saveState(uint8_t* buffer, size_t size) {
+    StateWriter state(buffer, size);
+    state.writeBytes("NSTA", 4);
+    state.write(SAVESTATE_VERSION);
+    state.write((uint32_t)0); // Total size, patched below
+
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        state.beginSection(SECTIONS[i].tag, SECTIONS[i].version);
+        saveSection(state, i, SECTIONS[i].version);
+        state.endSection();
+    }
+
+    if (state.Overflow()) return 0;
+    uint32_t total = (uint32_t)state.Size();
+    state.patch(8, &total, sizeof(total));
+    return state.Size();
+}
+
+bool Bus::loadState(const uint8_t* data, size_t size) {
+    StateReader header(data, size);
+    char magic[4];
+    uint32_t version = 0, total = 0;
+    header.readBytes(magic, 4);
+    header.read(version);
+    header.read(total);
+    if (header.Error() || memcmp(magic, "NSTA", 4) != 0 || version != SAVESTATE_VERSION || total > size) return false;
+
+    // Find every section and check its version and length before anything
+    // is loaded, so a bad snapshot leaves the machine untouched
+    const uint8_t* payload[SECTION_COUNT] = {};
+    uint32_t length[SECTION_COUNT] = {};
+    uint16_t versions[SECTION_COUNT] = {};
+    size_t pos = 12;
+    while (pos < total) {
+        StateReader section(data + pos, total - pos);
+        char tag[4];
+        uint16_t sectionVersion = 0;
+        uint32_t nLength = 0;
+        section.readBytes(tag, 4);
+        section.read(sectionVersion);
+        section.read(nLength);
+        if (section.Error() || nLength > section.Remaining()) return false;
+
+        for (int i = 0; i < SECTION_COUNT; i++) {
+            if (memcmp(tag, SECTIONS[i].tag, 4) != 0) continue;
+            if (payload[i] || sectionVersion < SECTIONS[i].oldest || sectionVersion > SECTIONS[i].version) return false;
+            payload[i] = data + pos + 10;
+            length[i] = nLength;
+            versions[i] = sectionVersion;
+        }
+        pos += 10 + nLength;
+    }
+
+    // Every component must be present and complete for the snapshot to be
+    // usable. Their sizes are fixed apart from the cartridge's RAM, which the
+    // CART section checks itself; it is loaded first so it can still refuse.
+    for (int i = 0; i < CART; i++) {
+        if (!payload[i]) return false;
+        StateWriter measure(nullptr, 0);
+        saveSection(measure, i, versions[i]);
+        if (length[i] != measure.Size()) return false;
+    }
+    if (!payload[CART]) return false;
+    StateReader cartState(payload[CART], length[CART]);
+    if (!cart->loadState(cartState, versions[CART])) return false;
+
+    StateReader busState(payload[BUS], length[BUS]);
+    StateReader cpuState(payload[CPU_REGS], length[CPU_REGS]);
+    StateReader ppuState(payload[PPU_REGS], length[PPU_REGS]);
+    StateReader apuState(payload[APU_REGS], length[APU_REGS]);
+    loadBusState(busState, versions[BUS]);
+    return cpu.loadState(cpuState, versions[CPU_REGS]) && ppu.loadState(ppuState, versions[PPU_REGS])
+           && apu.loadState(apuState, versions[APU_REGS]);
+}
@@ -1,8 +1,19 @@
 #include "Cartridge.h"
-#include <fstream>
-#include <iostream>
+#include "SaveState.h"
+#include "Hash.h"
+#include <cstring>
+#include <algorithm>
 
-Cartridge::Cartridge(const std::string& sFileName) {
+namespace {
+    // The NSF player idles in "JMP $4100" between INIT/PLAY calls. The
+    // $4100 area is otherwise unused by the NES, so the cartridge serves it.
+    const uint8_t NSF_IDLE_LOOP[3] = { 0x4C, 0x00, 0x41 };
+}
+
+Cartridge::Cartridge(const std::string& sFileName) : Cartridge(RomImage::open(sFileName)) {
+}
+
+Cartridge::Cartridge(std::shared_ptr<const RomImage> image) : rom(std::move(image)) {
     struct sHeader {
         char name[4];
         uint8_t prg_rom_chunks;
@@ -17,11 +28,9 @@ Cartridge::Cartridge(const std::string& sFileName) {
 
     bImageValid = false;
 
-    std::ifstream ifs;
-    ifs.open(sFileName, std::ifstream::binary);
-    if (ifs.is_open()) {
+    if (rom && rom->Size() >= sizeof(sHeader)) {
         // Read file header
-        ifs.read((char*)&header, sizeof(sHeader));
+        memcpy(&header, rom->Data(), sizeof(sHeader));
 
         if (header.name[0] == 'N' && header.name[1] == 'E' && header.name[2] == 'S' && header.name[3] == 0x1A) {
             
@@ -37,45 +46,184 @@ Cartridge::Cartridge(const std::string& sFileName) {
             if (header.mapper2 & 0x0C) nFileType = 2; // NES 2.0
 
             if (nFileType == 1) {
+                // PRG and CHR ROM are used in place, only CHR RAM is per cartridge
                 nPRGBanks = header.prg_rom_chunks;
-                vPRGMemory.resize(nPRGBanks * 16384);
-                ifs.read((char*)vPRGMemory.data(), vPRGMemory.size());
-
                 nCHRBanks = header.chr_rom_chunks;
-                if (nCHRBanks == 0) {
-                    // Create CHR RAM
-                    vCHRMemory.resize(8192);
-                } else {
-                    vCHRMemory.resize(nCHRBanks * 8192);
-                    ifs.read((char*)vCHRMemory.data(), vCHRMemory.size());
+                size_t nPRGSize = (size_t)nPRGBanks * 16384;
+                size_t nCHRSize = (size_t)nCHRBanks * 8192;
+
+                if (sizeof(sHeader) + nPRGSize + nCHRSize <= rom->Size()) {
+                    pPRGMemory = rom->Data() + sizeof(sHeader);
+                    nPRGMemorySize = nPRGSize;
+                    if (nCHRBanks == 0) {
+                        // Create CHR RAM
+                        vCHRRam.resize(8192);
+                        pCHRMemory = vCHRRam.data();
+                    } else {
+                        pCHRMemory = pPRGMemory + nPRGSize;
+                    }
+                    bImageValid = true;
                 }
-                
-                bImageValid = true;
-                std::cout << "ROM Loaded: " << sFileName << std::endl;
-                std::cout << "PRG Banks: " << (int)nPRGBanks << " CHR Banks: " << (int)nCHRBanks << " Mapper: " << (int)nMapperID << std::endl;
             }
         }
-        ifs.close();
+        else if (header.name[0] == 'N' && header.name[1] == 'E' && header.name[2] == 'S' && header.name[3] == 'M') {
+            loadNSF(rom->Data(), rom->Size());
+        }
+    }
+
+    if (bImageValid) {
+        nRomHash = Hash::hash64(pPRGMemory, nPRGMemorySize);
+        if (nCHRBanks > 0) nRomHash = Hash::hash64(pCHRMemory, (size_t)nCHRBanks * 8192, nRomHash);
     }
 }
 
+void Cartridge::loadNSF(const uint8_t* data, size_t size) {
+    const uint8_t* header = data;
+    if (size < 128 || header[4] != 0x1A) return;
+
+    auto word = [&](int offset) { return (uint16_t)(header[offset] | (header[offset + 1] << 8)); };
+    auto text = [&](int offset) { return std::string((const char*)&header[offset], strnlen((const char*)&header[offset], 32)); };
+
+    nsf.nSongs = header[0x06];
+    nsf.nStartSong = header[0x07];
+    nsf.nLoadAddr = word(0x08);
+    nsf.nInitAddr = word(0x0A);
+    nsf.nPlayAddr = word(0x0C);
+    nsf.sTitle = text(0x0E);
+    nsf.sArtist = text(0x2E);
+    nsf.sCopyright = text(0x4E);
+    if (word(0x6E) != 0) nsf.nSpeedNTSC = word(0x6E);
+    nsf.nExtraChips = header[0x7B];
+
+    for (int i = 0; i < 8; i++) {
+        nNSFBankInit[i] = header[0x70 + i];
+        if (nNSFBankInit[i] != 0) bNSFBankSwitched = true;
+    }
+
+    // Bank switched tunes are padded to a 4KB boundary, others are placed
+    // at their load address within the 32KB $8000-$FFFF window
+    size_t padding = 0;
+    if (bNSFBankSwitched) {
+        padding = nsf.nLoadAddr & 0x0FFF;
+    } else {
+        if (nsf.nLoadAddr < 0x8000) return;
+        padding = nsf.nLoadAddr - 0x8000;
+        for (int i = 0; i < 8; i++) nNSFBankInit[i] = i;
+    }
+
+    // The tune data is not bank aligned in the file, so NSF keeps a copy
+    vNSFMemory.assign(padding, 0x00);
+    vNSFMemory.insert(vNSFMemory.end(), data + 128, data + size);
+    vNSFMemory.resize(std::max<size_t>((vNSFMemory.size() + 0x0FFF) & ~(size_t)0x0FFF, 0x8000), 0x00);
+    pPRGMemory = vNSFMemory.data();
+    nPRGMemorySize = vNSFMemory.size();
+    nPRGBanks = (uint8_t)std::min<size_t>(vNSFMemory.size() / 16384, 255);
+
+    vPRGRam.assign(8192, 0x00);
+    vCHRRam.assign(8192, 0x00);
+    pCHRMemory = vCHRRam.data();
+    nCHRBanks = 0;
+
+    bNSF = true;
+    resetNSF();
+    bImageValid = true;
+}
+
+bool Cartridge::IsNSF() {
+    return bNSF;
+}
+
+void Cartridge::resetNSF() {
+    for (int i = 0; i < 8; i++) nNSFBank[i] = nNSFBankInit[i];
+    std::fill(vPRGRam.begin(), vPRGRam.end(), 0x00);
+}
+
 Cartridge::~Cartridge() {
 }
 
+std::shared_ptr<Cartridge> Cartridge::clone() const {
+    std::shared_ptr<Cartridge> copy(new Cartridge(*this));
+    if (pCHRMemory == vCHRRam.data()) copy->pCHRMemory = copy->vCHRRam.data();
+    if (pPRGMemory == vNSFMemory.data()) copy->pPRGMemory = copy->vNSFMemory.data();
+    return copy;
+}
+
 bool Cartridge::ImageValid() {
     return bImageValid;
 }
 
+uint64_t Cartridge::RomHash() {
+    return nRomHash;
+}
+
+uint8_t Cartridge::MapperID() {
+    return nMapperID;
+}
+
+uint8_t Cartridge::PRGBanks() {
+    return nPRGBanks;
+}
+
+uint8_t Cartridge::CHRBanks() {
+    return nCHRBanks;
+}
+
+void Cartridge::saveState(StateWriter& state) {
+    uint32_t nCHRRam = (uint32_t)vCHRRam.size();
+    state.write(nCHRRam);
+    state.writeBytes(vCHRRam.data(), nCHRRam);
+    uint32_t nPRGRam = (uint32_t)vPRGRam.size();
+    state.write(nPRGRam);
+    state.writeBytes(vPRGRam.data(), nPRGRam);
+    state.write(nNSFBank);
+}
+
+bool Cartridge::loadState(StateReader& state, uint16_t version) {
+    if (version != 1 || state.Remaining() < stateSize(*this)) return false;
+
+    // Both RAM sizes must match this cartridge before anything is copied
+    StateReader check = state;
+    uint32_t nCHRRam = 0, nPRGRam = 0;
+    check.read(nCHRRam);
+    check.skip(nCHRRam);
+    check.read(nPRGRam);
+    if (check.Error() || nCHRRam != vCHRRam.size() || nPRGRam != vPRGRam.size()) return false;
+
+    state.read(nCHRRam);
+    state.readBytes(vCHRRam.data(), nCHRRam);
+    state.read(nPRGRam);
+    state.readBytes(vPRGRam.data(), nPRGRam);
+    state.read(nNSFBank);
+    return !state.Error();
+}
+
 bool Cartridge::cpuRead(uint16_t addr, uint8_t &data) {
+    if (bNSF) {
+        if (addr >= 0x8000) {
+            size_t offset = (size_t)nNSFBank[(addr >> 12) & 0x07] * 4096 + (addr & 0x0FFF);
+            data = offset < nPRGMemorySize ? pPRGMemory[offset] : 0x00;
+            return true;
+        }
+        if (addr >= 0x6000) {
+            data = vPRGRam[addr & 0x1FFF];
+            return true;
+        }
+        if (addr >= 0x4100 && addr <= 0x4102) {
+            data = NSF_IDLE_LOOP[addr - 0x4100];
+            return true;
+        }
+        return false;
+    }
+
     // Mapper 0 Logic
     if (nMapperID == 0) {
         if (addr >= 0x8000 && addr <= 0xFFFF) {
             if (nPRGBanks > 1) {
                 // 32K ROM
-                data = vPRGMemory[addr & 0x7FFF];
+                data = pPRGMemory[addr & 0x7FFF];
             } else {
                 // 16K ROM (Mirrored)
-                data = vPRGMemory[addr & 0x3FFF];
+                data = pPRGMemory[addr & 0x3FFF];
             }
             return true;
         }
@@ -84,6 +232,19 @@ bool Cartridge::cpuRead(uint16_t addr, uint8_t &data) {
 }
 
 bool Cartridge::cpuWrite(uint16_t addr, uint8_t data) {
+    if (bNSF) {
+        if (addr >= 0x8000) return true;
+        if (addr >= 0x6000) {
+            vPRGRam[addr & 0x1FFF] = data;
+            return true;
+        }
+        if (addr >= 0x5FF8 && addr <= 0x5FFF) {
+            nNSFBank[addr & 0x07] = data;
+            return true;
+        }
+        return false;
+    }
+
     // Mapper 0 Logic
     if (nMapperID == 0) {
         if (addr >= 0x8000 && addr <= 0xFFFF) {
@@ -98,7 +259,7 @@ bool Cartridge::ppuRead(uint16_t addr, uint8_t &data) {
     // Mapper 0 Logic
     if (nMapperID == 0) {
         if (addr >= 0x0000 && addr <= 0x1FFF) {
-            data = vCHRMemory[addr];
+            data = pCHRMemory[addr];
             return true;
         }
     }
@@ -111,7 +272,7 @@ bool Cartridge::ppuWrite(uint16_t addr, uint8_t data) {
         if (addr >= 0x0000 && addr <= 0x1FFF) {
             if (nCHRBanks == 0) {
                 // If CHR RAM
-                vCHRMemory[addr] = data;
+                vCHRRam[addr] = data;
                 return true;
             }
         }
@@ -0,0 +1,103 @@
+#include "FramePacer.h"
+#include <algorithm>
+#include <thread>
+
+namespace {
+    const double NES_FRAME_RATE = 5369318.0 / (341.0 * 262.0);
+
+    // Latency adaption, in frames worth of audio
+    const double MIN_TARGET_FRAMES = 1.0;
+    const double MAX_TARGET_FRAMES = 8.0;
+    const uint32_t SHRINK_AFTER_FRAMES = 600;
+
+    // Maximum deviation of the resampling rate in vsync mode (0.5%)
+    const double MAX_RATE_ADJUST = 0.005;
+}
+
+FramePacer::FramePacer(double sampleRate, uint32_t deviceSamples, std::function<uint32_t()> queuedSamples)
+    : queuedSamples(queuedSamples), dSampleRate(sampleRate), dAudioRate(sampleRate), nDeviceSamples(deviceSamples) {
+    dFrameSamples = sampleRate / NES_FRAME_RATE;
+    dTargetSamples = std::max((double)deviceSamples, dFrameSamples * 2.0);
+    tFrameStart = tWindowStart = Clock::now();
+}
+
+void FramePacer::setMode(Mode m) {
+    mode = m;
+    dAudioRate = dSampleRate;
+}
+
+uint32_t FramePacer::MaxQueuedSamples() const {
+    return (uint32_t)(dFrameSamples * (MAX_TARGET_FRAMES + 2.0));
+}
+
+void FramePacer::beginFrame() {
+    tFrameStart = Clock::now();
+
+    if (mode == Mode::VSYNC) {
+        // Keep the queue centred on the target by slightly stretching or
+        // squeezing the emulated audio
+        double fill = queuedSamples() / (2.0 * dTargetSamples);
+        fill = std::min(std::max(fill, 0.0), 1.0);
+        stats.rateAdjust = 1.0 - MAX_RATE_ADJUST * (2.0 * fill - 1.0);
+        dAudioRate = dSampleRate * stats.rateAdjust;
+    }
+}
+
+void FramePacer::audioQueued() {
+    uint32_t queued = queuedSamples();
+
+    if (queued == 0 && !bFirstFrame) {
+        // The device ran dry, allow more audio to be buffered
+        stats.underruns++;
+        dTargetSamples = std::min(dTargetSamples + dFrameSamples, dFrameSamples * MAX_TARGET_FRAMES);
+        nStableFrames = 0;
+    } else if (++nStableFrames >= SHRINK_AFTER_FRAMES) {
+        double minimum = std::max((double)nDeviceSamples, dFrameSamples * MIN_TARGET_FRAMES);
+        dTargetSamples = std::max(dTargetSamples - dFrameSamples / 4.0, minimum);
+        nStableFrames = 0;
+    }
+    bFirstFrame = false;
+
+    dWindowLatencyMs += (queued + nDeviceSamples) * 1000.0 / dSampleRate;
+}
+
+void FramePacer::endFrame() {
+    double workMs = std::chrono::duration<double, std::milli>(Clock::now() - tFrameStart).count();
+
+    if (mode == Mode::AUDIO) {
+        // Sleep for most of the time it takes the queue to drain to the
+        // target, then poll for the remainder. A stalled device must not
+        // hang us.
+        Clock::time_point tWaitStart = Clock::now();
+        uint32_t queued;
+        while ((queued = queuedSamples()) > dTargetSamples && Clock::now() - tWaitStart < std::chrono::milliseconds(250)) {
+            double waitMs = (queued - dTargetSamples) * 1000.0 / dSampleRate;
+            if (waitMs > 2.0) {
+                std::this_thread::sleep_for(std::chrono::microseconds((int64_t)((waitMs - 1.0) * 1000.0)));
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(250));
+            }
+        }
+    }
+
+    nWindowFrames++;
+    dWindowWorkMs += workMs;
+    dWindowMaxMs = std::max(dWindowMaxMs, workMs);
+
+    Clock::time_point now = Clock::now();
+    double windowSec = std::chrono::duration<double>(now - tWindowStart).count();
+    if (windowSec >= 1.0) {
+        stats.fps = nWindowFrames / windowSec;
+        stats.frameTimeAvgMs = dWindowWorkMs / nWindowFrames;
+        stats.frameTimeMaxMs = dWindowMaxMs;
+        stats.audioLatencyMs = dWindowLatencyMs / nWindowFrames;
+        stats.targetLatencyMs = dTargetSamples * 1000.0 / dSampleRate;
+        stats.updated = true;
+
+        tWindowStart = now;
+        nWindowFrames = 0;
+        dWindowWorkMs = 0.0;
+        dWindowMaxMs = 0.0;
+        dWindowLatencyMs = 0.0;
+    }
+}
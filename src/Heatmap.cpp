@@ -0,0 +1,139 @@
+#include "Heatmap.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+
+namespace {
+    void put32be(std::vector<uint8_t>& v, uint32_t n) {
+        v.push_back(n >> 24); v.push_back(n >> 16); v.push_back(n >> 8); v.push_back(n);
+    }
+
+    uint32_t crc32(const uint8_t* data, size_t n, uint32_t crc = 0) {
+        static const std::array<uint32_t, 256> table = [] {
+            std::array<uint32_t, 256> t;
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                t[i] = c;
+            }
+            return t;
+        }();
+        crc = ~crc;
+        for (size_t i = 0; i < n; i++) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    void writeChunk(std::ofstream& ofs, const char* type, const std::vector<uint8_t>& data) {
+        std::vector<uint8_t> chunk;
+        put32be(chunk, (uint32_t)data.size());
+        chunk.insert(chunk.end(), type, type + 4);
+        chunk.insert(chunk.end(), data.begin(), data.end());
+        put32be(chunk, crc32(chunk.data() + 4, chunk.size() - 4));
+        ofs.write((const char*)chunk.data(), chunk.size());
+    }
+
+    // zlib stream of stored (uncompressed) deflate blocks, which keeps the
+    // writer tiny at the cost of file size
+    std::vector<uint8_t> zlibStored(const std::vector<uint8_t>& raw) {
+        std::vector<uint8_t> z = { 0x78, 0x01 };
+        size_t pos = 0;
+        do {
+            size_t n = std::min<size_t>(raw.size() - pos, 65535);
+            z.push_back(pos + n == raw.size() ? 1 : 0);
+            z.push_back(n & 0xFF); z.push_back(n >> 8);
+            z.push_back(~n & 0xFF); z.push_back((~n >> 8) & 0xFF);
+            z.insert(z.end(), raw.begin() + pos, raw.begin() + pos + n);
+            pos += n;
+        } while (pos < raw.size());
+
+        uint32_t s1 = 1, s2 = 0;
+        for (uint8_t b : raw) {
+            s1 = (s1 + b) % 65521;
+            s2 = (s2 + s1) % 65521;
+        }
+        put32be(z, (s2 << 16) | s1);
+        return z;
+    }
+}
+
+Heatmap::Heatmap() {
+    for (int k = 0; k < ACCESS_COUNT; k++) {
+        vCpu[k].assign(0x10000, 0);
+        vPpu[k].assign(0x4000, 0);
+    }
+}
+
+void Heatmap::clear() {
+    for (int k = 0; k < ACCESS_COUNT; k++) {
+        std::fill(vCpu[k].begin(), vCpu[k].end(), 0);
+        std::fill(vPpu[k].begin(), vPpu[k].end(), 0);
+    }
+    nFrames = 0;
+}
+
+void Heatmap::writeCSV(std::ostream& os) const {
+    double dFrames = (double)std::max<uint64_t>(nFrames, 1);
+    char line[160];
+    os << "space,address,reads,writes,executes,reads_per_frame,writes_per_frame,executes_per_frame\n";
+    auto rows = [&](const char* sSpace, const std::vector<uint64_t>* counts) {
+        for (size_t addr = 0; addr < counts[0].size(); addr++) {
+            uint64_t r = counts[READ][addr], w = counts[WRITE][addr], x = counts[EXECUTE][addr];
+            if (!r && !w && !x) continue;
+            snprintf(line, sizeof(line), "%s,$%04X,%llu,%llu,%llu,%.3f,%.3f,%.3f\n", sSpace, (unsigned)addr,
+                     (unsigned long long)r, (unsigned long long)w, (unsigned long long)x, r / dFrames, w / dFrames, x / dFrames);
+            os << line;
+        }
+    };
+    rows("cpu", vCpu);
+    rows("ppu", vPpu);
+}
+
+bool Heatmap::writeCpuPNG(const std::string& sFileName) const {
+    return writePNG(sFileName, vCpu, 256, 256, 2);
+}
+
+bool Heatmap::writePpuPNG(const std::string& sFileName) const {
+    return writePNG(sFileName, vPpu, 128, 128, 4);
+}
+
+bool Heatmap::writePNG(const std::string& sFileName, const std::vector<uint64_t>* counts, int nWidth, int nHeight, int nScale) const {
+    // Scale each channel so its busiest address is at full brightness
+    double dLogMax[ACCESS_COUNT];
+    for (int k = 0; k < ACCESS_COUNT; k++) {
+        uint64_t nMax = *std::max_element(counts[k].begin(), counts[k].end());
+        dLogMax[k] = nMax ? std::log1p((double)nMax) : 1.0;
+    }
+    auto level = [&](int k, size_t addr) {
+        return (uint8_t)(std::log1p((double)counts[k][addr]) / dLogMax[k] * 255.0 + 0.5);
+    };
+
+    // Filter type 0 (none) in front of every RGB row
+    int w = nWidth * nScale, h = nHeight * nScale;
+    std::vector<uint8_t> raw;
+    raw.reserve((size_t)(w * 3 + 1) * h);
+    for (int y = 0; y < h; y++) {
+        raw.push_back(0);
+        for (int x = 0; x < w; x++) {
+            size_t addr = (size_t)(y / nScale) * nWidth + x / nScale;
+            raw.push_back(level(WRITE, addr));
+            raw.push_back(level(READ, addr));
+            raw.push_back(level(EXECUTE, addr));
+        }
+    }
+
+    std::ofstream ofs(sFileName, std::ofstream::binary);
+    if (!ofs.is_open()) return false;
+    static const uint8_t SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    ofs.write((const char*)SIGNATURE, sizeof(SIGNATURE));
+
+    std::vector<uint8_t> ihdr;
+    put32be(ihdr, (uint32_t)w);
+    put32be(ihdr, (uint32_t)h);
+    ihdr.insert(ihdr.end(), { 8, 2, 0, 0, 0 });    // 8 bit RGB, no interlace
+    writeChunk(ofs, "IHDR", ihdr);
+    writeChunk(ofs, "IDAT", zlibStored(raw));
+    writeChunk(ofs, "IEND", {});
+    return ofs.good();
+}
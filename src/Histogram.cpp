@@ -0,0 +1,56 @@
+#include "Histogram.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    int highestBit(uint64_t v) {
+        int n = 0;
+        while (v >>= 1) n++;
+        return n;
+    }
+}
+
+Histogram::Histogram() : vBuckets(index(UINT64_MAX) + 1, 0) {
+}
+
+// Values below 2^SUB_BITS get a bucket each. Above that a value is shifted
+// down until it fits in [64, 128), and the shift selects the bucket group.
+size_t Histogram::index(uint64_t value) {
+    if (value < (1u << SUB_BITS)) return (size_t)value;
+    int shift = highestBit(value) - (SUB_BITS - 1);
+    return ((size_t)shift << (SUB_BITS - 1)) + (size_t)(value >> shift);
+}
+
+uint64_t Histogram::upperBound(size_t i) {
+    if (i < (1u << SUB_BITS)) return i;
+    int shift = (int)(i >> (SUB_BITS - 1)) - 1;
+    uint64_t sub = (i & ((1u << (SUB_BITS - 1)) - 1)) + (1u << (SUB_BITS - 1));
+    return ((sub + 1) << shift) - 1;
+}
+
+void Histogram::record(uint64_t value) {
+    vBuckets[index(value)]++;
+    nCount++;
+    nMin = std::min(nMin, value);
+    nMax = std::max(nMax, value);
+}
+
+void Histogram::clear() {
+    std::fill(vBuckets.begin(), vBuckets.end(), 0);
+    nCount = 0;
+    nMin = UINT64_MAX;
+    nMax = 0;
+}
+
+uint64_t Histogram::percentile(double p) const {
+    if (nCount == 0) return 0;
+    uint64_t nRank = (uint64_t)std::ceil(std::min(std::max(p, 0.0), 100.0) / 100.0 * nCount);
+    nRank = std::max<uint64_t>(nRank, 1);
+
+    uint64_t nSeen = 0;
+    for (size_t i = 0; i < vBuckets.size(); i++) {
+        nSeen += vBuckets[i];
+        if (nSeen >= nRank) return std::min(upperBound(i), nMax);
+    }
+    return nMax;
+}
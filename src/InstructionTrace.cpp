@@ -0,0 +1,58 @@
+#include "InstructionTrace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+InstructionTrace::InstructionTrace() : vRing(RING_RECORDS) {
+}
+
+InstructionTrace::~InstructionTrace() {
+    close();
+}
+
+bool InstructionTrace::open(const std::string& sFileName) {
+    close();
+    file = fopen(sFileName.c_str(), "wb");
+    if (!file) return false;
+
+    uint32_t header[3] = { 0, VERSION, (uint32_t)sizeof(Record) };
+    memcpy(header, "NCTR", 4);
+    fwrite(header, sizeof(header), 1, file);
+
+    nHead = 0;
+    nTail = 0;
+    bStop = false;
+    thread = std::thread(&InstructionTrace::writer, this);
+    return true;
+}
+
+void InstructionTrace::close() {
+    if (!file) return;
+    bStop = true;
+    thread.join();
+    fclose(file);
+    file = nullptr;
+}
+
+void InstructionTrace::writer() {
+    while (true) {
+        // Read the stop flag first, records published before it are drained
+        bool bLast = bStop.load(std::memory_order_acquire);
+        uint64_t tail = nTail.load(std::memory_order_relaxed);
+        uint64_t head = nHead.load(std::memory_order_acquire);
+        if (head == tail) {
+            if (bLast) return;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        // Write the filled span, in two parts where it wraps around the ring
+        while (tail != head) {
+            size_t start = (size_t)(tail & (RING_RECORDS - 1));
+            size_t n = (size_t)std::min<uint64_t>(head - tail, RING_RECORDS - start);
+            fwrite(&vRing[start], sizeof(Record), n, file);
+            tail += n;
+            nTail.store(tail, std::memory_order_release);
+        }
+    }
+}
@@ -0,0 +1,134 @@
+#include "LZ.h"
+#include <cstring>
+
+namespace {
+    const size_t MIN_MATCH = 4;
+    const int HASH_BITS = 12;
+    const size_t MAX_OFFSET = 0xFFFF;
+
+    inline uint32_t read32(const uint8_t* p) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    inline uint32_t hash(uint32_t v) {
+        return (v * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    // Lengths of 15 or more spill into extra bytes of 255 + remainder
+    inline bool writeLength(uint8_t*& op, const uint8_t* end, size_t len) {
+        while (len >= 255) {
+            if (op >= end) return false;
+            *op++ = 255;
+            len -= 255;
+        }
+        if (op >= end) return false;
+        *op++ = (uint8_t)len;
+        return true;
+    }
+
+    inline bool readLength(const uint8_t*& ip, const uint8_t* end, size_t& len) {
+        uint8_t b;
+        do {
+            if (ip >= end) return false;
+            b = *ip++;
+            len += b;
+        } while (b == 255);
+        return true;
+    }
+
+    bool emitSequence(uint8_t*& op, const uint8_t* end, const uint8_t* literals, size_t nLiterals, size_t offset, size_t matchLen) {
+        if (op >= end) return false;
+        uint8_t* token = op++;
+        size_t m = matchLen ? matchLen - MIN_MATCH : 0;
+        *token = (uint8_t)(((nLiterals < 15 ? nLiterals : 15) << 4) | (m < 15 ? m : 15));
+
+        if (nLiterals >= 15 && !writeLength(op, end, nLiterals - 15)) return false;
+        if ((size_t)(end - op) < nLiterals) return false;
+        memcpy(op, literals, nLiterals);
+        op += nLiterals;
+
+        if (matchLen) {
+            if (end - op < 2) return false;
+            *op++ = offset & 0xFF;
+            *op++ = (offset >> 8) & 0xFF;
+            if (m >= 15 && !writeLength(op, end, m - 15)) return false;
+        }
+        return true;
+    }
+}
+
+namespace LZ {
+
+size_t MaxCompressedSize(size_t n) {
+    return n + n / 255 + 16;
+}
+
+size_t compress(const uint8_t* src, size_t n, uint8_t* dst, size_t capacity) {
+    uint32_t table[1 << HASH_BITS];
+    memset(table, 0, sizeof(table)); // Positions are stored + 1, 0 is empty
+
+    uint8_t* op = dst;
+    const uint8_t* end = dst + capacity;
+    size_t ip = 0;
+    size_t anchor = 0;
+
+    while (n >= MIN_MATCH && ip <= n - MIN_MATCH) {
+        uint32_t seq = read32(src + ip);
+        uint32_t h = hash(seq);
+        size_t ref = table[h];
+        table[h] = (uint32_t)(ip + 1);
+
+        if (ref && ip - (ref - 1) <= MAX_OFFSET && read32(src + ref - 1) == seq) {
+            size_t match = ref - 1;
+            size_t len = MIN_MATCH;
+            while (ip + len < n && src[match + len] == src[ip + len]) len++;
+
+            if (!emitSequence(op, end, src + anchor, ip - anchor, ip - match, len)) return 0;
+            ip += len;
+            anchor = ip;
+        } else {
+            ip++;
+        }
+    }
+
+    // Trailing literals form a final sequence without a match
+    if (!emitSequence(op, end, src + anchor, n - anchor, 0, 0)) return 0;
+    return op - dst;
+}
+
+size_t decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t capacity) {
+    const uint8_t* ip = src;
+    const uint8_t* end = src + n;
+    size_t op = 0;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+
+        size_t nLiterals = token >> 4;
+        if (nLiterals == 15 && !readLength(ip, end, nLiterals)) return 0;
+        if ((size_t)(end - ip) < nLiterals || capacity - op < nLiterals) return 0;
+        memcpy(dst + op, ip, nLiterals);
+        ip += nLiterals;
+        op += nLiterals;
+
+        if (ip >= end) break; // Final sequence
+
+        if (end - ip < 2) return 0;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t len = token & 0x0F;
+        if (len == 15 && !readLength(ip, end, len)) return 0;
+        len += MIN_MATCH;
+
+        if (offset == 0 || offset > op || capacity - op < len) return 0;
+        // Byte by byte, matches may overlap their own output
+        const uint8_t* match = dst + op - offset;
+        for (size_t i = 0; i < len; i++) dst[op + i] = match[i];
+        op += len;
+    }
+    return op;
+}
+
+}
@@ -0,0 +1,267 @@
+#include "Movie.h"
+#include "Bus.h"
+#include "CPU.h"
+#include "PPU.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+    const uint16_t MOVIE_VERSION = 2;
+    const size_t MAX_STATE_SIZE = 64 * 1024;
+    const size_t HEADER_SIZE = 24;
+    const size_t TRAILER_SIZE = 12;
+
+    template<typename T>
+    void put(std::vector<uint8_t>& out, T v) {
+        const uint8_t* p = (const uint8_t*)&v;
+        out.insert(out.end(), p, p + sizeof(T));
+    }
+
+    void putTag(std::vector<uint8_t>& out, const char tag[4]) {
+        out.insert(out.end(), tag, tag + 4);
+    }
+
+    template<typename T>
+    bool get(const std::vector<uint8_t>& in, size_t& pos, T& v) {
+        if (pos + sizeof(T) > in.size()) return false;
+        memcpy(&v, &in[pos], sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+
+    template<typename T>
+    bool get(std::ifstream& ifs, T& v) {
+        return (bool)ifs.read((char*)&v, sizeof(T));
+    }
+}
+
+Movie::Movie(uint32_t nKeyframeInterval) : nKeyframeInterval(nKeyframeInterval) {
+}
+
+void Movie::startRecording(Bus& bus) {
+    nRomHash = bus.cart->RomHash();
+    vKeyframes.clear();
+    vInput.clear();
+    nFrame = 0;
+    sFileName.clear();
+}
+
+void Movie::record(Bus& bus) {
+    // The machine is at the start of frame nFrame
+    if (nFrame % nKeyframeInterval == 0) {
+        Keyframe key;
+        key.nFrame = nFrame;
+        key.vState.resize(MAX_STATE_SIZE);
+        key.vState.resize(bus.saveState(key.vState.data(), key.vState.size()));
+        vKeyframes.push_back(std::move(key));
+    }
+
+    vInput.push_back(bus.controller[0]);
+    vInput.push_back(bus.controller[1]);
+    nFrame++;
+}
+
+bool Movie::save(const std::string& sFileName) {
+    // Keyframes of a loaded movie may still be on disk
+    for (auto& key : vKeyframes) {
+        if (!readKeyframe(key)) return false;
+    }
+
+    std::vector<uint8_t> out;
+    out.insert(out.end(), { 'N', 'M', 'O', 'V' });
+    put(out, MOVIE_VERSION);
+    put(out, (uint16_t)0);
+    put(out, nRomHash);
+    put(out, FrameCount());
+    put(out, nKeyframeInterval);
+
+    // Each keyframe is followed by the input up to the next one
+    std::vector<uint64_t> offsets;
+    for (size_t i = 0; i < vKeyframes.size(); i++) {
+        const Keyframe& key = vKeyframes[i];
+        offsets.push_back(out.size());
+        putTag(out, "STAT");
+        put(out, key.nFrame);
+        put(out, (uint32_t)key.vState.size());
+        out.insert(out.end(), key.vState.begin(), key.vState.end());
+
+        uint32_t nEnd = i + 1 < vKeyframes.size() ? vKeyframes[i + 1].nFrame : FrameCount();
+        if (nEnd > key.nFrame) {
+            putTag(out, "INPT");
+            put(out, key.nFrame);
+            put(out, nEnd - key.nFrame);
+            out.insert(out.end(), vInput.begin() + key.nFrame * 2, vInput.begin() + nEnd * 2);
+        }
+    }
+
+    uint64_t nIndexOffset = out.size();
+    putTag(out, "INDX");
+    put(out, (uint32_t)vKeyframes.size());
+    for (size_t i = 0; i < vKeyframes.size(); i++) {
+        put(out, vKeyframes[i].nFrame);
+        put(out, offsets[i]);
+    }
+    put(out, nIndexOffset);
+    putTag(out, "NMVI");
+
+    std::ofstream ofs(sFileName, std::ofstream::binary);
+    if (!ofs.is_open()) return false;
+    ofs.write((const char*)out.data(), out.size());
+    return ofs.good();
+}
+
+bool Movie::load(const std::string& sFileName) {
+    std::ifstream ifs(sFileName, std::ifstream::binary);
+    if (!ifs.is_open()) return false;
+
+    this->sFileName = sFileName;
+    nFrame = 0;
+    nRomHash = 0;
+    vKeyframes.clear();
+    vInput.clear();
+
+    char magic[4] = { 0 };
+    uint16_t version = 0, flags = 0;
+    ifs.read(magic, 4);
+    get(ifs, version);
+    if (!ifs || memcmp(magic, "NMOV", 4) != 0 || version != MOVIE_VERSION) {
+        // Older formats are small, read them whole
+        ifs.clear();
+        ifs.seekg(0);
+        std::vector<uint8_t> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        return loadVersion1(data);
+    }
+
+    uint32_t frames = 0;
+    if (!get(ifs, flags) || !get(ifs, nRomHash) || !get(ifs, frames) || !get(ifs, nKeyframeInterval)) return false;
+    if (nKeyframeInterval == 0) nKeyframeInterval = 1;
+
+    // The trailer points at the keyframe index
+    uint64_t nIndexOffset = 0;
+    ifs.seekg(0, std::ifstream::end);
+    uint64_t nFileSize = (uint64_t)ifs.tellg();
+    if (nFileSize < HEADER_SIZE + TRAILER_SIZE) return false;
+    ifs.seekg(nFileSize - TRAILER_SIZE);
+    if (!get(ifs, nIndexOffset) || !ifs.read(magic, 4) || memcmp(magic, "NMVI", 4) != 0) return false;
+    if (nIndexOffset < HEADER_SIZE || nIndexOffset > nFileSize - TRAILER_SIZE) return false;
+
+    ifs.seekg(nIndexOffset);
+    uint32_t count = 0;
+    if (!ifs.read(magic, 4) || memcmp(magic, "INDX", 4) != 0 || !get(ifs, count)) return false;
+    for (uint32_t i = 0; i < count; i++) {
+        Keyframe key;
+        if (!get(ifs, key.nFrame) || !get(ifs, key.nOffset)) return false;
+        vKeyframes.push_back(std::move(key));
+    }
+
+    // Collect the input chunks, stepping over the keyframes
+    vInput.resize((size_t)frames * 2);
+    ifs.seekg(HEADER_SIZE);
+    while ((uint64_t)ifs.tellg() < nIndexOffset) {
+        uint32_t first = 0, size = 0;
+        if (!ifs.read(magic, 4) || !get(ifs, first) || !get(ifs, size)) return false;
+        if (memcmp(magic, "INPT", 4) == 0) {
+            if ((uint64_t)first + size > frames) return false;
+            if (!ifs.read((char*)vInput.data() + (size_t)first * 2, (size_t)size * 2)) return false;
+        } else {
+            ifs.seekg(size, std::ifstream::cur);
+        }
+    }
+    return true;
+}
+
+bool Movie::loadVersion1(const std::vector<uint8_t>& data) {
+    if (data.size() < 4 || memcmp(data.data(), "NMOV", 4) != 0) {
+        // Raw input file
+        vInput = data;
+        vInput.resize(vInput.size() & ~(size_t)1);
+        return true;
+    }
+
+    size_t pos = 4;
+    uint16_t version = 0, flags = 0;
+    uint32_t frames = 0, stateSize = 0;
+    if (!get(data, pos, version) || !get(data, pos, flags) || !get(data, pos, nRomHash)
+        || !get(data, pos, frames) || !get(data, pos, stateSize)) return false;
+    if (version != 1 || pos + stateSize + (size_t)frames * 2 > data.size()) return false;
+
+    Keyframe key;
+    key.vState.assign(data.begin() + pos, data.begin() + pos + stateSize);
+    vKeyframes.push_back(std::move(key));
+    pos += stateSize;
+    vInput.assign(data.begin() + pos, data.begin() + pos + (size_t)frames * 2);
+    return true;
+}
+
+bool Movie::readKeyframe(Keyframe& key) {
+    if (!key.vState.empty()) return true;
+
+    std::ifstream ifs(sFileName, std::ifstream::binary);
+    char tag[4];
+    uint32_t frame = 0, size = 0;
+    ifs.seekg(key.nOffset);
+    if (!ifs.read(tag, 4) || memcmp(tag, "STAT", 4) != 0 || !get(ifs, frame) || !get(ifs, size)) return false;
+    if (frame != key.nFrame || size > MAX_STATE_SIZE) return false;
+    key.vState.resize(size);
+    return (bool)ifs.read((char*)key.vState.data(), size);
+}
+
+bool Movie::restore(Bus& bus, Keyframe& key) {
+    if (!readKeyframe(key) || !bus.loadState(key.vState.data(), key.vState.size())) {
+        std::cerr << "Movie keyframe at frame " << key.nFrame << " could not be loaded" << std::endl;
+        return false;
+    }
+    nFrame = key.nFrame;
+    return true;
+}
+
+bool Movie::start(Bus& bus) {
+    nFrame = 0;
+    if (nRomHash != 0 && nRomHash != bus.cart->RomHash()) {
+        std::cerr << "Movie was recorded with a different ROM" << std::endl;
+        return false;
+    }
+    // Raw input files start from power on
+    if (vKeyframes.empty() || vKeyframes[0].nFrame != 0) return true;
+    return restore(bus, vKeyframes[0]);
+}
+
+bool Movie::nextFrame(Bus& bus) {
+    if (Finished()) return false;
+    bus.controller[0] = vInput[nFrame * 2 + 0];
+    bus.controller[1] = vInput[nFrame * 2 + 1];
+    nFrame++;
+    return true;
+}
+
+long Movie::seek(Bus& bus, uint32_t nTarget) {
+    if (nTarget > FrameCount()) return -1;
+
+    // Nearest keyframe at or before the target, unless playback is already
+    // closer than that
+    Keyframe* key = nullptr;
+    for (auto& k : vKeyframes) {
+        if (k.nFrame <= nTarget && (!key || k.nFrame > key->nFrame)) key = &k;
+    }
+    bool bContinue = nFrame <= nTarget && (!key || nFrame >= key->nFrame);
+    if (!bContinue) {
+        if (!key) return -1;
+        if (!restore(bus, *key)) return -1;
+    }
+
+    // Fast forward silently, then hand the machine back with the caller's
+    // output settings
+    long nEmulated = 0;
+    bool bVideo = bus.ppu.VideoOutput(), bAudio = bus.AudioOutput();
+    bus.ppu.setVideoOutput(false);
+    bus.setAudioOutput(false);
+    while (nFrame < nTarget) {
+        nextFrame(bus);
+        bus.clockFrame();
+        nEmulated++;
+    }
+    bus.ppu.setVideoOutput(bVideo);
+    bus.setAudioOutput(bAudio);
+    return nEmulated;
+}
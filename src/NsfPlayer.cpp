@@ -0,0 +1,74 @@
+#include "NsfPlayer.h"
+#include "Bus.h"
+#include "CPU.h"
+
+namespace {
+    // Idle loop served by the cartridge, see Cartridge.cpp
+    const uint16_t IDLE_ADDR = 0x4100;
+
+    // Upper bound for INIT, which may legitimately run for a long time
+    const uint32_t INIT_CYCLE_LIMIT = 1789773 * 4;
+}
+
+NsfPlayer::NsfPlayer(Bus* bus) : bus(bus) {
+    dPlayPeriod = bus->cart->nsf.nSpeedNTSC * 1.789773;
+}
+
+void NsfPlayer::startTrack(uint8_t track) {
+    for (auto& i : bus->cpuRam) i = 0x00;
+    bus->cart->resetNSF();
+
+    // Silence the APU as the NSF specification requires
+    for (uint16_t addr = 0x4000; addr <= 0x4013; addr++) bus->write(addr, 0x00);
+    bus->write(0x4015, 0x00);
+    bus->write(0x4015, 0x0F);
+    bus->write(0x4017, 0x40);
+
+    bus->cpu.stkp = 0xFD;
+    bus->cpu.status = 0x24;
+    bus->cpu.cycles = 0;
+    bus->cpu.a = track > 0 ? track - 1 : 0;
+    bus->cpu.x = 0x00; // NTSC
+    bus->cpu.y = 0x00;
+    call(bus->cart->nsf.nInitAddr);
+
+    for (uint32_t i = 0; i < INIT_CYCLE_LIMIT && !idle(); i++) {
+        bus->clockCPU();
+    }
+
+    dPlayCounter = 0.0;
+    bPlayPending = true;
+}
+
+void NsfPlayer::run(uint32_t nCycles) {
+    for (uint32_t i = 0; i < nCycles; i++) {
+        dPlayCounter -= 1.0;
+        if (dPlayCounter <= 0.0) {
+            dPlayCounter += dPlayPeriod;
+            bPlayPending = true;
+        }
+
+        // A PLAY call that overran its period is allowed to finish first
+        if (bPlayPending && idle()) {
+            bPlayPending = false;
+            call(bus->cart->nsf.nPlayAddr);
+        }
+
+        bus->clockCPU();
+    }
+}
+
+void NsfPlayer::call(uint16_t addr) {
+    // Push a return address so the routine's RTS lands on the idle loop
+    uint16_t ret = IDLE_ADDR - 1;
+    bus->write(0x0100 + bus->cpu.stkp, (ret >> 8) & 0x00FF);
+    bus->cpu.stkp--;
+    bus->write(0x0100 + bus->cpu.stkp, ret & 0x00FF);
+    bus->cpu.stkp--;
+    bus->cpu.pc = addr;
+}
+
+bool NsfPlayer::idle() {
+    // Only take over the CPU between instructions
+    return bus->cpu.cycles == 0 && bus->cpu.pc >= IDLE_ADDR && bus->cpu.pc <= IDLE_ADDR + 2;
+}
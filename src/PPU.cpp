@@ -1,34 +1,48 @@
 #include "PPU.h"
 #include "Cartridge.h"
+#include "SaveState.h"
+#include "PerfCounters.h"
+#include "Trace.h"
+#include "Heatmap.h"
 #include <cstring>
+#include <algorithm>
+#include <iterator>
+
+namespace {
+    // Fixed NES Palette, shared by every PPU
+    const uint32_t PALETTE[64] = {
+        0xFF7C7C7C, 0xFF0000FC, 0xFF0000BC, 0xFF4428BC,
+        0xFF940084, 0xFFA80020, 0xFFA81000, 0xFF881400,
+        0xFF503000, 0xFF007800, 0xFF006800, 0xFF005800,
+        0xFF004058, 0xFF000000, 0xFF000000, 0xFF000000,
+
+        0xFFBCBCBC, 0xFF0078F8, 0xFF0058F8, 0xFF6844FC,
+        0xFFD800CC, 0xFFE40058, 0xFFF83800, 0xFFE45C10,
+        0xFFAC7C00, 0xFF00B800, 0xFF00A800, 0xFF00A844,
+        0xFF008888, 0xFF000000, 0xFF000000, 0xFF000000,
+
+        0xFFF8F8F8, 0xFF3CBCFC, 0xFF6888FC, 0xFF9878F8,
+        0xFFF878F8, 0xFFF85898, 0xFFF87858, 0xFFFCA044,
+        0xFFF8B800, 0xFFB8F818, 0xFF58D854, 0xFF58F898,
+        0xFF00E8D8, 0xFF787878, 0xFF000000, 0xFF000000,
+
+        0xFFFCFCFC, 0xFFA4E4FC, 0xFFB8B8F8, 0xFFD8B8F8,
+        0xFFF8B8F8, 0xFFF8A4C0, 0xFFF0D0B0, 0xFFFCE0A8,
+        0xFFF8D878, 0xFFD8F878, 0xFFB8F8B8, 0xFFB8F8D8,
+        0xFF00FCFC, 0xFFF8D8F8, 0xFF000000, 0xFF000000,
+    };
+}
 
 PPU::PPU() {
-    // Fixed NES Palette
-    palScreen[0x00] = 0xFF7C7C7C; palScreen[0x01] = 0xFF0000FC; palScreen[0x02] = 0xFF0000BC; palScreen[0x03] = 0xFF4428BC;
-    palScreen[0x04] = 0xFF940084; palScreen[0x05] = 0xFFA80020; palScreen[0x06] = 0xFFA81000; palScreen[0x07] = 0xFF881400;
-    palScreen[0x08] = 0xFF503000; palScreen[0x09] = 0xFF007800; palScreen[0x0A] = 0xFF006800; palScreen[0x0B] = 0xFF005800;
-    palScreen[0x0C] = 0xFF004058; palScreen[0x0D] = 0xFF000000; palScreen[0x0E] = 0xFF000000; palScreen[0x0F] = 0xFF000000;
-
-    palScreen[0x10] = 0xFFBCBCBC; palScreen[0x11] = 0xFF0078F8; palScreen[0x12] = 0xFF0058F8; palScreen[0x13] = 0xFF6844FC;
-    palScreen[0x14] = 0xFFD800CC; palScreen[0x15] = 0xFFE40058; palScreen[0x16] = 0xFFF83800; palScreen[0x17] = 0xFFE45C10;
-    palScreen[0x18] = 0xFFAC7C00; palScreen[0x19] = 0xFF00B800; palScreen[0x1A] = 0xFF00A800; palScreen[0x1B] = 0xFF00A844;
-    palScreen[0x1C] = 0xFF008888; palScreen[0x1D] = 0xFF000000; palScreen[0x1E] = 0xFF000000; palScreen[0x1F] = 0xFF000000;
-
-    palScreen[0x20] = 0xFFF8F8F8; palScreen[0x21] = 0xFF3CBCFC; palScreen[0x22] = 0xFF6888FC; palScreen[0x23] = 0xFF9878F8;
-    palScreen[0x24] = 0xFFF878F8; palScreen[0x25] = 0xFFF85898; palScreen[0x26] = 0xFFF87858; palScreen[0x27] = 0xFFFCA044;
-    palScreen[0x28] = 0xFFF8B800; palScreen[0x29] = 0xFFB8F818; palScreen[0x2A] = 0xFF58D854; palScreen[0x2B] = 0xFF58F898;
-    palScreen[0x2C] = 0xFF00E8D8; palScreen[0x2D] = 0xFF787878; palScreen[0x2E] = 0xFF000000; palScreen[0x2F] = 0xFF000000;
-
-    palScreen[0x30] = 0xFFFCFCFC; palScreen[0x31] = 0xFFA4E4FC; palScreen[0x32] = 0xFFB8B8F8; palScreen[0x33] = 0xFFD8B8F8;
-    palScreen[0x34] = 0xFFF8B8F8; palScreen[0x35] = 0xFFF8A4C0; palScreen[0x36] = 0xFFF0D0B0; palScreen[0x37] = 0xFFFCE0A8;
-    palScreen[0x38] = 0xFFF8D878; palScreen[0x39] = 0xFFD8F878; palScreen[0x3A] = 0xFFB8F8B8; palScreen[0x3B] = 0xFFB8F8D8;
-    palScreen[0x3C] = 0xFF00FCFC; palScreen[0x3D] = 0xFFF8D8F8; palScreen[0x3E] = 0xFF000000; palScreen[0x3F] = 0xFF000000;
-
-    memset(sprScreen, 0, sizeof(sprScreen));
     memset(tblName, 0, sizeof(tblName));
     memset(tblPalette, 0, sizeof(tblPalette));
     memset(oam, 0, sizeof(oam));
     memset(spriteScanline, 0, sizeof(spriteScanline));
+
+    status.reg = 0;
+    control.reg = 0;
+    mask.reg = 0;
+    std::fill(std::begin(bRowDirty), std::end(bRowDirty), true);
     
     vram_addr.reg = 0;
     tram_addr.reg = 0;
@@ -49,7 +63,35 @@ void PPU::ConnectCartridge(const std::shared_ptr<Cartridge>& cart) {
 }
 
 uint32_t* PPU::GetScreen() {
-    return sprScreen;
+    allocateScreen();
+    return sprScreen.data();
+}
+
+void PPU::allocateScreen() {
+    if (sprScreen.empty()) sprScreen.resize(256 * 240);
+}
+
+// Switching to the internal screen allocates it straight away, as the
+// switch may come in the middle of a row
+void PPU::setVideoOutput(bool enable) {
+    bVideoOutput = enable;
+    if (bVideoOutput && !pTarget) allocateScreen();
+}
+
+void PPU::setRenderTarget(void* pixels, int nPitch, PixelFormat format) {
+    pTarget = (uint8_t*)pixels;
+    nTargetPitch = nPitch;
+    eTargetFormat = format;
+    std::fill(std::begin(bRowDirty), std::end(bRowDirty), true);
+    if (bVideoOutput && !pTarget) allocateScreen();
+}
+
+void PPU::clearDirtyRows() {
+    std::fill(std::begin(bRowDirty), std::end(bRowDirty), false);
+}
+
+const uint32_t* PPU::GetPalette() {
+    return PALETTE;
 }
 
 void PPU::setOAMAddress(uint8_t addr) {
@@ -61,6 +103,70 @@ void PPU::writeOAMData(uint8_t data) {
     oam_addr++;
 }
 
+void PPU::saveState(StateWriter& state) {
+    state.writeBytes(tblName, sizeof(tblName));
+    state.writeBytes(tblPalette, sizeof(tblPalette));
+    state.writeBytes(oam, sizeof(oam));
+    state.write(oam_addr);
+    state.write(spriteScanline);
+    state.write(sprite_count);
+    state.write(scanline);
+    state.write(cycle);
+    state.write(status.reg);
+    state.write(control.reg);
+    state.write(mask.reg);
+    state.write(address_latch);
+    state.write(ppu_data_buffer);
+    state.write(vram_addr.reg);
+    state.write(tram_addr.reg);
+    state.write(fine_x);
+    state.write(write_toggle);
+    state.write(bg_shifter_pattern_lo);
+    state.write(bg_shifter_pattern_hi);
+    state.write(bg_shifter_attrib_lo);
+    state.write(bg_shifter_attrib_hi);
+    state.write(bg_next_tile_id);
+    state.write(bg_next_tile_attrib);
+    state.write(bg_next_tile_lsb);
+    state.write(bg_next_tile_msb);
+    state.write(nmi);
+}
+
+bool PPU::loadState(StateReader& state, uint16_t version) {
+    if (version != 1 || state.Remaining() < stateSize(*this)) return false;
+    state.readBytes(tblName, sizeof(tblName));
+    state.readBytes(tblPalette, sizeof(tblPalette));
+    state.readBytes(oam, sizeof(oam));
+    state.read(oam_addr);
+    state.read(spriteScanline);
+    state.read(sprite_count);
+    state.read(scanline);
+    state.read(cycle);
+    state.read(status.reg);
+    state.read(control.reg);
+    state.read(mask.reg);
+    state.read(address_latch);
+    state.read(ppu_data_buffer);
+    state.read(vram_addr.reg);
+    state.read(tram_addr.reg);
+    state.read(fine_x);
+    state.read(write_toggle);
+    state.read(bg_shifter_pattern_lo);
+    state.read(bg_shifter_pattern_hi);
+    state.read(bg_shifter_attrib_lo);
+    state.read(bg_shifter_attrib_hi);
+    state.read(bg_next_tile_id);
+    state.read(bg_next_tile_attrib);
+    state.read(bg_next_tile_lsb);
+    state.read(bg_next_tile_msb);
+    state.read(nmi);
+    if (state.Error()) return false;
+
+    // The state may resume in the middle of a row
+    if (bVideoOutput && !pTarget) allocateScreen();
+    return true;
+}
+
 uint8_t PPU::cpuRead(uint16_t addr, bool rdonly) {
     uint8_t data = 0x00;
     switch (addr) {
@@ -141,6 +247,9 @@ void PPU::cpuWrite(uint16_t addr, uint8_t data) {
 uint8_t PPU::ppuRead(uint16_t addr, bool rdonly) {
     uint8_t data = 0x00;
     addr &= 0x3FFF;
+#ifdef NES_HEATMAP
+    if (heatmap && !rdonly) heatmap->ppu(Heatmap::READ, addr);
+#endif
 
     if (cart->ppuRead(addr, data)) {
         // Cartridge
@@ -173,6 +282,9 @@ uint8_t PPU::ppuRead(uint16_t addr, bool rdonly) {
 
 void PPU::ppuWrite(uint16_t addr, uint8_t data) {
     addr &= 0x3FFF;
+#ifdef NES_HEATMAP
+    if (heatmap) heatmap->ppu(Heatmap::WRITE, addr);
+#endif
     if (cart->ppuWrite(addr, data)) {
         // Cartridge
     } else if (addr >= 0x2000 && addr <= 0x3EFF) {
@@ -338,6 +450,12 @@ void PPU::clock() {
                 }
             }
             sprite_count = nOAMEntry;
+#ifdef NES_PERF_COUNTERS
+            if (perf) {
+                perf->nSpriteEvaluations++;
+                perf->nSpritesFound += nOAMEntry;
+            }
+#endif
         }
     }
 
@@ -404,31 +522,62 @@ void PPU::clock() {
             }
         }
         
-        uint32_t final_color = palScreen[this->ppuRead(0x3F00)];
+        // Select the visible pixel, palette entry 0 is the backdrop
+        uint8_t pixel = 0;
+        uint8_t palette = 0;
         
         if (bg_pixel == 0 && spr_pixel == 0) {
-            final_color = palScreen[this->ppuRead(0x3F00)];
+            // Backdrop
         } else if (bg_pixel != 0 && spr_pixel == 0) {
-            final_color = palScreen[this->ppuRead(0x3F00 + (bg_palette << 2) + bg_pixel)];
+            pixel = bg_pixel;
+            palette = bg_palette;
         } else if (bg_pixel == 0 && spr_pixel != 0) {
-            final_color = palScreen[this->ppuRead(0x3F00 + (spr_palette << 2) + spr_pixel)];
+            pixel = spr_pixel;
+            palette = spr_palette;
         } else {
             if (spr_zero && mask.render_background && mask.render_sprites) {
+                bool bHit;
                 if (!mask.render_background_left || !mask.render_sprites_left) {
-                    if (cycle - 1 >= 8) status.sprite_zero_hit = 1;
+                    bHit = cycle - 1 >= 8;
                 } else {
-                    if (cycle - 1 != 255) status.sprite_zero_hit = 1;
+                    bHit = cycle - 1 != 255;
                 }
+                if (bHit && !status.sprite_zero_hit && trace) trace->instant("Sprite 0 hit");
+                if (bHit) status.sprite_zero_hit = 1;
             }
             
             if (spr_priority) {
-                final_color = palScreen[this->ppuRead(0x3F00 + (spr_palette << 2) + spr_pixel)];
+                pixel = spr_pixel;
+                palette = spr_palette;
             } else {
-                final_color = palScreen[this->ppuRead(0x3F00 + (bg_palette << 2) + bg_pixel)];
+                pixel = bg_pixel;
+                palette = bg_palette;
             }
         }
         
-        sprScreen[scanline * 256 + (cycle - 1)] = final_color;
+        if (bVideoOutput) {
+            uint8_t colour = this->ppuRead(0x3F00 + (palette << 2) + pixel) & 0x3F;
+
+            // FNV-1a over the row's colour numbers, compared when it ends.
+            // A PPU that was never told where to draw gets its screen here,
+            // once per row rather than per pixel.
+            if (cycle == 1) {
+                nRowHash = 0xCBF29CE484222325ULL;
+                if (!pTarget) allocateScreen();
+            }
+            if (pTarget) {
+                uint8_t* row = pTarget + scanline * nTargetPitch;
+                if (eTargetFormat == PixelFormat::INDEX8) row[cycle - 1] = colour;
+                else ((uint32_t*)row)[cycle - 1] = PALETTE[colour];
+            } else {
+                sprScreen[scanline * 256 + (cycle - 1)] = PALETTE[colour];
+            }
+            nRowHash = (nRowHash ^ colour) * 0x100000001B3ULL;
+            if (cycle == 256 && nRowHash != nPrevRowHash[scanline]) {
+                nPrevRowHash[scanline] = nRowHash;
+                bRowDirty[scanline] = true;
+            }
+        }
     }
 
     cycle++;
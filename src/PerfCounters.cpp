@@ -0,0 +1,35 @@
+#include "PerfCounters.h"
+#include <cstdio>
+
+void PerfCounters::print(std::ostream& os) const {
+    static const char* REGION_NAMES[REGION_COUNT] = { "RAM", "PPU", "APU/IO", "Cart", "Open" };
+    char line[160];
+
+    snprintf(line, sizeof(line), "Instructions %llu, CPU cycles %llu, audio samples %llu\n",
+             (unsigned long long)nInstructions, (unsigned long long)nCpuCycles, (unsigned long long)nAudioSamples);
+    os << line;
+
+    os << "Reads/writes:";
+    for (int r = 0; r < REGION_COUNT; r++) {
+        snprintf(line, sizeof(line), " %s %llu/%llu", REGION_NAMES[r], (unsigned long long)nReads[r], (unsigned long long)nWrites[r]);
+        os << line;
+    }
+    os << "\n";
+
+    // Only the scanlines that saw PPU register writes
+    uint64_t nPpuWrites = 0;
+    os << "PPU writes by scanline:";
+    for (int i = 0; i < 262; i++) {
+        if (!nPpuWritesPerScanline[i]) continue;
+        nPpuWrites += nPpuWritesPerScanline[i];
+        snprintf(line, sizeof(line), " %d:%u", i - 1, nPpuWritesPerScanline[i]);
+        os << line;
+    }
+    snprintf(line, sizeof(line), " (total %llu)\nSprite evaluations %llu, sprites found %llu\n",
+             (unsigned long long)nPpuWrites, (unsigned long long)nSpriteEvaluations, (unsigned long long)nSpritesFound);
+    os << line;
+
+    snprintf(line, sizeof(line), "Host time: CPU %.3f ms, PPU %.3f ms, APU %.3f ms\n",
+             nHostNs[CPU] / 1e6, nHostNs[PPU] / 1e6, nHostNs[APU] / 1e6);
+    os << line;
+}
@@ -0,0 +1,91 @@
+#include "Profiler.h"
+#include "Bus.h"
+#include "CPU.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+    // Games that leave routines without RTS (stack resets, RTS jump tables)
+    // would grow the shadow stack forever, so it is bounded
+    const size_t MAX_DEPTH = 256;
+    const size_t MAX_ANNOTATED_INSTRUCTIONS = 64;
+
+    double percent(uint64_t n, uint64_t total) {
+        return total ? 100.0 * (double)n / (double)total : 0.0;
+    }
+}
+
+Profiler::Profiler() {
+    vPCCycles.resize(65536);
+    vRoutineCycles.resize(65536);
+    vRoutineCalls.resize(65536);
+    vStack.reserve(MAX_DEPTH);
+}
+
+void Profiler::reset(uint16_t nEntry) {
+    std::fill(vPCCycles.begin(), vPCCycles.end(), 0);
+    std::fill(vRoutineCycles.begin(), vRoutineCycles.end(), 0);
+    std::fill(vRoutineCalls.begin(), vRoutineCalls.end(), 0);
+    vStack.clear();
+    this->nEntry = nEntry;
+    nRoutine = nEntry;
+    nTotalCycles = 0;
+}
+
+void Profiler::enter(uint16_t nRoutineAddr) {
+    if (vStack.size() >= MAX_DEPTH) vStack.erase(vStack.begin());
+    vStack.push_back(nRoutine);
+    vRoutineCalls[nRoutineAddr]++;
+    nRoutine = nRoutineAddr;
+}
+
+void Profiler::leave() {
+    if (vStack.empty()) return;
+    nRoutine = vStack.back();
+    vStack.pop_back();
+}
+
+void Profiler::report(std::ostream& os, Bus& bus, size_t nRoutines, size_t nAnnotate) const {
+    std::vector<uint16_t> routines;
+    for (uint32_t addr = 0; addr < 65536; addr++) {
+        if (vRoutineCycles[addr]) routines.push_back((uint16_t)addr);
+    }
+    std::sort(routines.begin(), routines.end(), [this](uint16_t a, uint16_t b) { return vRoutineCycles[a] > vRoutineCycles[b]; });
+    if (routines.size() > nRoutines) routines.resize(nRoutines);
+
+    char line[128];
+    snprintf(line, sizeof(line), "6502 profile: %llu cycles (%.1f frames)\n\n", (unsigned long long)nTotalCycles, nTotalCycles / 29780.5);
+    os << line << "  self cycles        %      calls  routine\n";
+    for (uint16_t addr : routines) {
+        snprintf(line, sizeof(line), "%13llu  %6.2f%%  %9u  $%04X%s\n", (unsigned long long)vRoutineCycles[addr],
+                 percent(vRoutineCycles[addr], nTotalCycles), vRoutineCalls[addr], addr, addr == nEntry ? " (entry)" : "");
+        os << line;
+    }
+
+    // Disassemble each hot routine from its entry until it returns or jumps
+    // away and execution does not continue past that point
+    for (size_t i = 0; i < std::min(nAnnotate, routines.size()); i++) {
+        uint16_t addr = routines[i];
+        snprintf(line, sizeof(line), "\n$%04X: %.2f%% self\n", addr, percent(vRoutineCycles[addr], nTotalCycles));
+        os << line;
+        for (size_t n = 0; n < MAX_ANNOTATED_INSTRUCTIONS; n++) {
+            uint8_t bytes[3] = { bus.read(addr, true), bus.read((uint16_t)(addr + 1), true), bus.read((uint16_t)(addr + 2), true) };
+            uint8_t length = 1;
+            std::string text = CPU::disassemble(addr, bytes, length);
+
+            char hex[12];
+            if (length == 1) snprintf(hex, sizeof(hex), "%02X", bytes[0]);
+            else if (length == 2) snprintf(hex, sizeof(hex), "%02X %02X", bytes[0], bytes[1]);
+            else snprintf(hex, sizeof(hex), "%02X %02X %02X", bytes[0], bytes[1], bytes[2]);
+            uint64_t cycles = vPCCycles[addr];
+            if (cycles) snprintf(line, sizeof(line), "  %04X  %-8s  %-14s %12llu  %6.2f%%\n", addr, hex, text.c_str(), (unsigned long long)cycles, percent(cycles, nTotalCycles));
+            else snprintf(line, sizeof(line), "  %04X  %-8s  %s\n", addr, hex, text.c_str());
+            os << line;
+
+            uint16_t next = (uint16_t)(addr + length);
+            bool bEnds = bytes[0] == 0x60 || bytes[0] == 0x40 || bytes[0] == 0x4C || bytes[0] == 0x6C;
+            if (bEnds && vPCCycles[next] == 0) break;
+            addr = next;
+        }
+    }
+}
@@ -0,0 +1,139 @@
+#include "Rewind.h"
+#include "Bus.h"
+#include "LZ.h"
+#include <cstring>
+
+namespace {
+    const size_t MAX_STATE_SIZE = 64 * 1024;
+}
+
+Rewind::Rewind(size_t nCapacityBytes, uint32_t nKeyframeInterval) : nKeyframeInterval(nKeyframeInterval) {
+    vRing.resize(nCapacityBytes);
+    // Even fully compressed deltas take a few bytes, this bounds the entry count
+    vEntries.resize(nCapacityBytes / 16 + 1);
+    vState.resize(MAX_STATE_SIZE);
+    vKeyframe.resize(MAX_STATE_SIZE);
+}
+
+void Rewind::clear() {
+    nFirstSeq += nCount;
+    nCount = 0;
+    nWritePos = 0;
+    nBytesUsed = 0;
+    nSinceKeyframe = 0;
+    nKeyframeSeq = UINT64_MAX;
+}
+
+bool Rewind::push(Bus& bus) {
+    size_t size = bus.saveState(vState.data(), vState.size());
+    if (size == 0) return false;
+
+    // Deltas need a keyframe of the same size that is still in the buffer
+    bool bKeyframe = nCount == 0 || nSinceKeyframe >= nKeyframeInterval || size != nStateSize
+                     || nKeyframeSeq < nFirstSeq || nKeyframeSeq == UINT64_MAX;
+
+    uint64_t seq = nFirstSeq + nCount;
+    if (bKeyframe) {
+        memcpy(vKeyframe.data(), vState.data(), size);
+        nKeyframeSeq = seq;
+        nStateSize = size;
+        nSinceKeyframe = 0;
+    } else {
+        for (size_t i = 0; i < size; i++) vState[i] ^= vKeyframe[i];
+    }
+    nSinceKeyframe++;
+
+    size_t bound = LZ::MaxCompressedSize(size);
+    if (bound > vRing.size()) return false;
+    size_t offset = reserve(bound);
+
+    // Reserving space may have evicted the keyframe we are about to refer to
+    if (!bKeyframe && nKeyframeSeq < nFirstSeq) {
+        nSinceKeyframe = 0;
+        nKeyframeSeq = UINT64_MAX;
+        return false;
+    }
+
+    size_t compressed = LZ::compress(vState.data(), size, &vRing[offset], bound);
+    if (compressed == 0) return false;
+
+    if (nCount == vEntries.size()) evictOldest();
+    seq = nFirstSeq + nCount;
+    Entry& e = entry(seq);
+    e.offset = offset;
+    e.size = (uint32_t)compressed;
+    e.bKeyframe = bKeyframe;
+    e.nKeySeq = bKeyframe ? seq : nKeyframeSeq;
+    if (bKeyframe) nKeyframeSeq = seq;
+    nCount++;
+
+    nWritePos = offset + compressed;
+    nBytesUsed += compressed;
+    return true;
+}
+
+bool Rewind::pop(Bus& bus) {
+    if (nCount == 0) return false;
+
+    uint64_t seq = nFirstSeq + nCount - 1;
+    Entry e = entry(seq);
+    if (!loadKeyframe(e.nKeySeq)) return false;
+
+    bool ok = true;
+    if (e.bKeyframe) {
+        ok = bus.loadState(vKeyframe.data(), nStateSize);
+    } else {
+        size_t size = LZ::decompress(&vRing[e.offset], e.size, vState.data(), vState.size());
+        if (size != nStateSize) return false;
+        for (size_t i = 0; i < size; i++) vState[i] ^= vKeyframe[i];
+        ok = bus.loadState(vState.data(), size);
+    }
+
+    // Drop the entry, new captures continue from here
+    nCount--;
+    nBytesUsed -= e.size;
+    nWritePos = e.offset;
+    if (e.bKeyframe) {
+        nKeyframeSeq = UINT64_MAX;
+        nSinceKeyframe = 0;
+    } else {
+        nSinceKeyframe = (uint32_t)(seq - e.nKeySeq);
+    }
+    return ok;
+}
+
+bool Rewind::loadKeyframe(uint64_t seq) {
+    if (seq == nKeyframeSeq) return true;
+    if (seq < nFirstSeq) return false;
+
+    const Entry& key = entry(seq);
+    size_t size = LZ::decompress(&vRing[key.offset], key.size, vKeyframe.data(), vKeyframe.size());
+    if (size == 0) return false;
+    nStateSize = size;
+    nKeyframeSeq = seq;
+    return true;
+}
+
+size_t Rewind::reserve(size_t nBytes) {
+    if (nWritePos + nBytes > vRing.size()) {
+        // Entries past the write position are the oldest, drop them and wrap
+        while (nCount > 0 && entry(nFirstSeq).offset >= nWritePos) evictOldest();
+        nWritePos = 0;
+    }
+
+    while (nCount > 0) {
+        const Entry& oldest = entry(nFirstSeq);
+        if (oldest.offset >= nWritePos && oldest.offset < nWritePos + nBytes) evictOldest();
+        else break;
+    }
+    return nWritePos;
+}
+
+void Rewind::evictOldest() {
+    // Deltas are useless without their keyframe, drop the whole group
+    do {
+        nBytesUsed -= entry(nFirstSeq).size;
+        nFirstSeq++;
+        nCount--;
+    } while (nCount > 0 && !entry(nFirstSeq).bKeyframe);
+}
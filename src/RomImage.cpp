@@ -0,0 +1,71 @@
+#include "RomImage.h"
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    std::mutex mtxCache;
+    std::unordered_map<std::string, std::weak_ptr<const RomImage>> mapCache;
+}
+
+RomImage::~RomImage() {
+#ifndef _WIN32
+    if (pMapping) munmap(pMapping, nSize);
+#endif
+}
+
+std::shared_ptr<const RomImage> RomImage::open(const std::string& sFileName) {
+    std::lock_guard<std::mutex> lock(mtxCache);
+    auto it = mapCache.find(sFileName);
+    if (it != mapCache.end()) {
+        if (auto image = it->second.lock()) return image;
+    }
+
+    auto image = load(sFileName);
+    if (image) mapCache[sFileName] = image;
+    else mapCache.erase(sFileName);
+    return image;
+}
+
+std::shared_ptr<const RomImage> RomImage::load(const std::string& sFileName) {
+    std::shared_ptr<RomImage> image(new RomImage());
+
+#ifndef _WIN32
+    int fd = ::open(sFileName.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            image->pMapping = p;
+            image->pData = (const uint8_t*)p;
+            image->nSize = (size_t)st.st_size;
+        }
+    }
+    close(fd);
+    if (image->pMapping) return image;
+#endif
+
+    // No mmap, read the file instead
+    std::ifstream ifs(sFileName, std::ifstream::binary);
+    if (!ifs.is_open()) return nullptr;
+    image->vData.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    image->pData = image->vData.data();
+    image->nSize = image->vData.size();
+    return image;
+}
+
+std::shared_ptr<const RomImage> RomImage::fromMemory(std::vector<uint8_t> vData) {
+    std::shared_ptr<RomImage> image(new RomImage());
+    image->vData = std::move(vData);
+    image->pData = image->vData.data();
+    image->nSize = image->vData.size();
+    return image;
+}
@@ -0,0 +1,91 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+namespace {
+    // Pool and queue of the worker running on this thread, if any
+    thread_local const ThreadPool* tlsPool = nullptr;
+    thread_local unsigned tlsQueue = 0;
+}
+
+ThreadPool::ThreadPool(unsigned nThreads) {
+    if (nThreads == 0) nThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 0; i < nThreads; i++) vQueues.push_back(std::make_unique<Queue>());
+    for (unsigned i = 0; i < nThreads; i++) vThreads.emplace_back(&ThreadPool::worker, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mtxState);
+        bStop = true;
+    }
+    cvWork.notify_all();
+    for (auto& t : vThreads) t.join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    unsigned index = tlsPool == this ? tlsQueue : nNextQueue++ % vQueues.size();
+    nPending++;
+    {
+        std::lock_guard<std::mutex> lock(vQueues[index]->mtx);
+        vQueues[index]->tasks.push_back(std::move(task));
+    }
+    {
+        // Counted under the lock so a worker about to sleep cannot miss it
+        std::lock_guard<std::mutex> lock(mtxState);
+        nQueued++;
+    }
+    cvWork.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mtxState);
+    cvDone.wait(lock, [this] { return nPending == 0; });
+}
+
+bool ThreadPool::take(unsigned index, std::function<void()>& task) {
+    // Own queue first, newest task (still warm in cache)
+    {
+        Queue& q = *vQueues[index];
+        std::lock_guard<std::mutex> lock(q.mtx);
+        if (!q.tasks.empty()) {
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+            return true;
+        }
+    }
+    // Then steal the oldest task of the other workers
+    for (size_t i = 1; i < vQueues.size(); i++) {
+        Queue& q = *vQueues[(index + i) % vQueues.size()];
+        std::lock_guard<std::mutex> lock(q.mtx);
+        if (!q.tasks.empty()) {
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::worker(unsigned index) {
+    tlsPool = this;
+    tlsQueue = index;
+
+    std::function<void()> task;
+    while (true) {
+        if (take(index, task)) {
+            nQueued--;
+            task();
+            task = nullptr;
+            if (--nPending == 0) {
+                std::lock_guard<std::mutex> lock(mtxState);
+                cvDone.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mtxState);
+        cvWork.wait(lock, [this] { return bStop || nQueued > 0; });
+        if (bStop && nQueued == 0) return;
+    }
+}
@@ -0,0 +1,70 @@
+#include "Trace.h"
+
+Trace::~Trace() {
+    close();
+}
+
+bool Trace::open(const std::string& sFileName) {
+    close();
+    file = fopen(sFileName.c_str(), "wb");
+    if (!file) return false;
+
+    // Everything is recorded on one thread, name it for the viewer
+    fputs("{\"traceEvents\":[\n"
+          "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"Emulation\"}}", file);
+    tOpen = std::chrono::steady_clock::now();
+    vBlock.reserve(BLOCK_EVENTS);
+    bStop = false;
+    thread = std::thread(&Trace::writer, this);
+    return true;
+}
+
+void Trace::close() {
+    if (!file) return;
+    submit();
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        bStop = true;
+    }
+    cv.notify_one();
+    thread.join();
+
+    fputs("\n],\"displayTimeUnit\":\"ms\"}\n", file);
+    fclose(file);
+    file = nullptr;
+}
+
+void Trace::submit() {
+    if (vBlock.empty()) return;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        qPending.push_back(std::move(vBlock));
+    }
+    cv.notify_one();
+    vBlock = std::vector<Event>();
+    vBlock.reserve(BLOCK_EVENTS);
+}
+
+void Trace::writer() {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (true) {
+        cv.wait(lock, [this] { return bStop || !qPending.empty(); });
+        if (qPending.empty()) return;
+        std::vector<Event> block = std::move(qPending.front());
+        qPending.pop_front();
+        lock.unlock();
+
+        // Timestamps are in microseconds, kept to the nanosecond
+        for (const Event& e : block) {
+            if (e.phase == 'X') {
+                fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%llu.%03u,\"dur\":%llu.%03u}", e.name,
+                        (unsigned long long)(e.nStart / 1000), (unsigned)(e.nStart % 1000),
+                        (unsigned long long)(e.nDuration / 1000), (unsigned)(e.nDuration % 1000));
+            } else {
+                fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":1,\"ts\":%llu.%03u}", e.name,
+                        (unsigned long long)(e.nStart / 1000), (unsigned)(e.nStart % 1000));
+            }
+        }
+        lock.lock();
+    }
+}
@@ -0,0 +1,89 @@
+#include "VecEnv.h"
+#include "Bus.h"
+#include "PPU.h"
+#include "Cartridge.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    const size_t MAX_STATE_SIZE = 64 * 1024;
+    const size_t FRAME_SIZE = 256 * 240;
+    const size_t RAM_SIZE = 2048;
+}
+
+VecEnv::VecEnv(const std::string& sRomFile, size_t nEnvs, unsigned nThreads) : pool(nThreads) {
+    for (size_t i = 0; i < nEnvs; i++) {
+        auto cart = std::make_shared<Cartridge>(sRomFile);
+        if (!cart->ImageValid() || cart->IsNSF()) return;
+
+        auto bus = std::make_unique<Bus>();
+        bus->insertCartridge(cart);
+        bus->reset();
+        bus->setAudioOutput(false);
+        bus->ppu.setVideoOutput(false);     // step() turns it on to draw observations
+        vEnvs.push_back(std::move(bus));
+    }
+    if (vEnvs.empty()) return;
+
+    // Every instance powers on identically, one snapshot serves all resets
+    vStartState.resize(MAX_STATE_SIZE);
+    nStartStateSize = vEnvs[0]->saveState(vStartState.data(), vStartState.size());
+    bValid = nStartStateSize > 0;
+
+    // One contiguous range of instances per worker. The tasks only capture
+    // this and their index, so submitting a copy does not allocate.
+    size_t nChunks = std::min(vEnvs.size(), (size_t)pool.ThreadCount());
+    nChunkSize = (vEnvs.size() + nChunks - 1) / nChunks;
+    for (size_t nBegin = 0; nBegin < vEnvs.size(); nBegin += nChunkSize) {
+        vTasks.push_back([this, nBegin] { stepRange(nBegin, std::min(nBegin + nChunkSize, vEnvs.size())); });
+    }
+}
+
+VecEnv::~VecEnv() {
+}
+
+void VecEnv::setObservationBuffers(uint8_t* pFrames, uint8_t* pRam) {
+    this->pFrames = pFrames;
+    this->pRam = pRam;
+    for (size_t i = 0; i < vEnvs.size(); i++) {
+        vEnvs[i]->ppu.setRenderTarget(pFrames ? pFrames + i * FRAME_SIZE : nullptr, 256, PPU::PixelFormat::INDEX8);
+    }
+}
+
+bool VecEnv::reset() {
+    bool ok = true;
+    for (size_t i = 0; i < vEnvs.size(); i++) ok = reset(i) && ok;
+    return ok;
+}
+
+bool VecEnv::reset(size_t index) {
+    return vEnvs[index]->loadState(vStartState.data(), nStartStateSize);
+}
+
+void VecEnv::step(const uint8_t* pInput, uint32_t nFrames) {
+    pStepInput = pInput;
+    nStepFrames = std::max(1u, nFrames);
+
+    for (const auto& task : vTasks) pool.submit(task);
+    pool.wait();
+}
+
+void VecEnv::stepRange(size_t nBegin, size_t nEnd) {
+    for (size_t i = nBegin; i < nEnd; i++) {
+        Bus& nes = *vEnvs[i];
+        nes.controller[0] = pStepInput ? pStepInput[i] : 0x00;
+        nes.controller[1] = 0x00;
+
+        nes.ppu.setVideoOutput(false);
+        for (uint32_t frame = 0; frame < nStepFrames; frame++) {
+            if (frame == nStepFrames - 1) nes.ppu.setVideoOutput(pFrames != nullptr);
+            nes.clockFrame();
+        }
+
+        if (pRam) memcpy(pRam + i * RAM_SIZE, nes.cpuRam.data(), RAM_SIZE);
+    }
+}
+
+const uint32_t* VecEnv::Palette() {
+    return vEnvs.empty() ? nullptr : vEnvs[0]->ppu.GetPalette();
+}
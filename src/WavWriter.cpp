@@ -0,0 +1,81 @@
+#include "WavWriter.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    const size_t BUFFER_SAMPLES = 16384;
+
+    void put16(uint8_t* p, uint16_t v) { p[0] = v & 0xFF; p[1] = v >> 8; }
+    void put32(uint8_t* p, uint32_t v) { put16(p, v & 0xFFFF); put16(p + 2, v >> 16); }
+
+    // 44 byte canonical header, IEEE float format (3)
+    void buildHeader(uint8_t* h, uint32_t sampleRate, uint32_t dataBytes) {
+        memcpy(h + 0, "RIFF", 4);
+        put32(h + 4, 36 + dataBytes);
+        memcpy(h + 8, "WAVE", 4);
+        memcpy(h + 12, "fmt ", 4);
+        put32(h + 16, 16);
+        put16(h + 20, 3);                  // WAVE_FORMAT_IEEE_FLOAT
+        put16(h + 22, 1);                  // Mono
+        put32(h + 24, sampleRate);
+        put32(h + 28, sampleRate * sizeof(float));
+        put16(h + 32, sizeof(float));
+        put16(h + 34, 32);
+        memcpy(h + 36, "data", 4);
+        put32(h + 40, dataBytes);
+    }
+}
+
+WavWriter::WavWriter(const std::string& sFileName, uint32_t sampleRate) : nSampleRate(sampleRate) {
+    buffer.reserve(BUFFER_SAMPLES);
+    ofs.open(sFileName, std::ofstream::binary | std::ofstream::trunc);
+    if (ofs.is_open()) {
+        // Placeholder header, sizes are filled in by close()
+        uint8_t header[44];
+        buildHeader(header, nSampleRate, 0);
+        ofs.write((const char*)header, sizeof(header));
+    }
+}
+
+WavWriter::~WavWriter() {
+    close();
+}
+
+bool WavWriter::IsOpen() {
+    return ofs.is_open();
+}
+
+void WavWriter::write(const float* samples, size_t count) {
+    while (count > 0) {
+        size_t n = std::min(count, BUFFER_SAMPLES - buffer.size());
+        buffer.insert(buffer.end(), samples, samples + n);
+        samples += n;
+        count -= n;
+        if (buffer.size() == BUFFER_SAMPLES) flush();
+    }
+}
+
+void WavWriter::flush() {
+    if (!buffer.empty()) {
+        ofs.write((const char*)buffer.data(), buffer.size() * sizeof(float));
+        nSamplesWritten += buffer.size();
+        buffer.clear();
+    }
+}
+
+// The stream's failbit is sticky, so checking it after closing covers the
+// header, every block of samples, the seek back and the close itself
+bool WavWriter::close() {
+    if (!ofs.is_open()) return bClosedOk;
+    flush();
+
+    // The RIFF sizes are 32 bit
+    uint64_t nDataBytes = nSamplesWritten * sizeof(float);
+    uint8_t header[44];
+    buildHeader(header, nSampleRate, (uint32_t)nDataBytes);
+    ofs.seekp(0);
+    ofs.write((const char*)header, sizeof(header));
+    ofs.close();
+    bClosedOk = !ofs.fail() && nDataBytes <= 0xFFFFFFFFull - 36;
+    return bClosedOk;
+}
@@ -1,30 +1,434 @@
 #include <iostream>
 #include <iomanip>
+#include <fstream>
 #include <SDL.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <memory>
+#include <stdexcept>
+#include <string>
 #include <vector>
 #include "Bus.h"
 #include "CPU.h"
 #include "PPU.h"
 #include "APU.h"
 #include "Cartridge.h"
+#include "WavWriter.h"
+#include "NsfPlayer.h"
+#include "FramePacer.h"
+#include "Rewind.h"
+#include "Movie.h"
+#include "Profiler.h"
+#include "Trace.h"
+#include "Histogram.h"
+#include "InstructionTrace.h"
+#include "Heatmap.h"
 
 // Audio settings
 const int SAMPLE_RATE = 44100;
-const int SAMPLES_PER_FRAME = SAMPLE_RATE / 60;
+
+// NTSC frame rate: 5369318 Hz PPU clock / (341 * 262) cycles per frame
+const double FRAME_RATE = 5369318.0 / (341.0 * 262.0);
+
+struct Options {
+    std::string sRomFile = "mario.nes";
+    std::string sWavFile;       // Headless audio render target
+    std::string sPlayFile;      // Input movie to play back
+    std::string sRecordFile;    // Input movie to record
+    long nSeek = 0;             // Movie frame to start playback from
+    bool bHeadless = false;
+    double dSeconds = -1.0;     // Run length, defaults to the movie length or 60 s
+    long nFrames = -1;
+    int nTrack = 0;             // NSF song, 0 selects the file's starting song
+    bool bVsync = false;        // Pace by display refresh instead of the audio clock
+    int nRunAhead = 0;          // Frames to run ahead of the real machine state
+    std::string sProfileFile;   // 6502 profile report, needs NES_PROFILER
+    std::string sTraceFile;     // Chrome trace-event JSON of frame phases
+    std::string sCpuTraceFile;  // Binary per-instruction trace
+    std::string sHeatmapPrefix; // Memory access heatmap files, needs NES_HEATMAP
+};
+
+static void printUsage(const char* name) {
+    std::cout << "Usage: " << name << " [rom.nes] [options]\n"
+              << "  --headless         Run without a window as fast as possible\n"
+              << "  --wav <file>       Render audio to a WAV file (implies --headless)\n"
+              << "  --seconds <n>      Length of a headless run (default: movie length or 60)\n"
+              << "  --frames <n>       Length of a headless run in video frames\n"
+              << "  --play <file>      Play back an input movie (--input is an alias)\n"
+              << "  --seek <n>         Start movie playback at frame n\n"
+              << "  --record <file>    Record the controller input to a movie\n"
+              << "  --track <n>        Song to play from an NSF file\n"
+              << "  --vsync            Pace frames with the display refresh when it is close to 60 Hz\n"
+              << "  --runahead <n>     Show the frame n frames ahead of the game to hide input lag\n"
+              << "  --profile <file>   Write a 6502 hot routine report on exit (NES_PROFILER builds)\n"
+              << "  --trace <file>     Write a Chrome/Perfetto trace of frame phases and NMI/DMA/sprite 0 events\n"
+              << "  --cputrace <file>  Record every CPU instruction, decode with nes_tracedump\n"
+              << "  --heatmap <prefix> Write memory access counts to <prefix>.csv and PNG images on exit (NES_HEATMAP builds)\n";
+}
+
+static bool parseOptions(int argc, char* argv[], Options& opt) {
+    // Values that are not numbers (std::sto* throws) show the usage
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "--wav" && hasValue) opt.sWavFile = argv[++i];
+            else if (arg == "--seconds" && hasValue) opt.dSeconds = std::stod(argv[++i]);
+            else if (arg == "--frames" && hasValue) opt.nFrames = std::stol(argv[++i]);
+            else if ((arg == "--play" || arg == "--input") && hasValue) opt.sPlayFile = argv[++i];
+            else if (arg == "--seek" && hasValue) opt.nSeek = std::max(0L, std::stol(argv[++i]));
+            else if (arg == "--record" && hasValue) opt.sRecordFile = argv[++i];
+            else if (arg == "--headless") opt.bHeadless = true;
+            else if (arg == "--track" && hasValue) opt.nTrack = std::stoi(argv[++i]);
+            else if (arg == "--vsync") opt.bVsync = true;
+            else if (arg == "--profile" && hasValue) opt.sProfileFile = argv[++i];
+            else if (arg == "--trace" && hasValue) opt.sTraceFile = argv[++i];
+            else if (arg == "--cputrace" && hasValue) opt.sCpuTraceFile = argv[++i];
+            else if (arg == "--heatmap" && hasValue) opt.sHeatmapPrefix = argv[++i];
+            else if (arg == "--runahead" && hasValue) opt.nRunAhead = std::max(0, std::stoi(argv[++i]));
+            else if (arg.size() > 1 && arg[0] == '-') return false;
+            else opt.sRomFile = arg;
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+// Host timings of a run, printed on exit and with the H key
+struct FrameTimes {
+    Histogram hFrame;       // Work per frame, excluding the pacing wait
+    Histogram hEmulate;
+    Histogram hPresent;
+    Histogram hLatency;     // Input poll to the end of the present
+
+    static uint64_t since(std::chrono::steady_clock::time_point t) {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t).count();
+    }
+
+    void print(std::ostream& os) const {
+        auto line = [&](const char* name, const Histogram& h) {
+            if (h.Count() == 0) return;
+            char text[160];
+            snprintf(text, sizeof(text), "%-18s n=%-7llu p50 %6.2f  p95 %6.2f  p99 %6.2f  max %6.2f ms\n", name,
+                     (unsigned long long)h.Count(), h.percentile(50) / 1e6, h.percentile(95) / 1e6,
+                     h.percentile(99) / 1e6, h.Max() / 1e6);
+            os << text;
+        };
+        line("Frame", hFrame);
+        line("Emulate", hEmulate);
+        line("Present", hPresent);
+        line("Input to present", hLatency);
+    }
+};
+
+// Loads the movie and puts the machine at its first frame, or at the --seek
+// frame by way of the nearest keyframe
+static bool startMovie(Movie& movie, Bus& nes, const Options& opt) {
+    if (!movie.load(opt.sPlayFile)) {
+        std::cerr << "Failed to load movie " << opt.sPlayFile << std::endl;
+        return false;
+    }
+    if (!movie.start(nes)) return false;
+    if (opt.nSeek > 0) {
+        auto tStart = std::chrono::steady_clock::now();
+        long nEmulated = movie.seek(nes, (uint32_t)std::min<long>(opt.nSeek, movie.FrameCount()));
+        if (nEmulated < 0) {
+            std::cerr << "Failed to seek to frame " << opt.nSeek << std::endl;
+            return false;
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+        std::cout << "Seeked to frame " << movie.CurrentFrame() << " (" << nEmulated << " frames emulated in "
+                  << std::fixed << std::setprecision(1) << ms << " ms)" << std::endl;
+        std::cout.unsetf(std::ios::floatfield);
+    }
+    return true;
+}
+
+// Runs the emulator without a window as fast as possible, optionally driven
+// by a movie and streaming the APU output to a WAV file
+static int runHeadless(Bus& nes, const Options& opt, Trace* trace) {
+    std::unique_ptr<WavWriter> wav;
+    if (!opt.sWavFile.empty()) {
+        wav = std::make_unique<WavWriter>(opt.sWavFile, SAMPLE_RATE);
+        if (!wav->IsOpen()) {
+            std::cerr << "Failed to open " << opt.sWavFile << std::endl;
+            return 1;
+        }
+    }
+
+    Movie movie;
+    if (!opt.sPlayFile.empty() && !startMovie(movie, nes, opt)) return 1;
+
+    Movie recording;
+    if (!opt.sRecordFile.empty()) recording.startRecording(nes);
+
+    long nFrames = opt.nFrames;
+    if (nFrames < 0) {
+        if (opt.dSeconds >= 0.0) nFrames = (long)(opt.dSeconds * FRAME_RATE + 0.5);
+        else if (!opt.sPlayFile.empty()) nFrames = movie.FrameCount() - movie.CurrentFrame();
+        else nFrames = (long)(60.0 * FRAME_RATE + 0.5);
+    }
+    nes.setAudioSampleRate(SAMPLE_RATE);
+
+    FrameTimes times;
+    auto tStart = std::chrono::steady_clock::now();
+    for (long frame = 0; frame < nFrames; frame++) {
+        Trace::Span frameSpan(trace, "Frame");
+        if (!movie.nextFrame(nes)) {
+            nes.controller[0] = 0x00;
+            nes.controller[1] = 0x00;
+        }
+        if (!opt.sRecordFile.empty()) recording.record(nes);
+
+        {
+            Trace::Span span(trace, "Emulate");
+            auto tEmulate = std::chrono::steady_clock::now();
+            nes.clockFrame();
+            times.hEmulate.record(FrameTimes::since(tEmulate));
+        }
+        if (wav) {
+            Trace::Span span(trace, "Write WAV");
+            wav->write(nes.audioBuffer.data(), nes.audioBuffer.size());
+        }
+        nes.audioBuffer.clear();
+    }
+    bool bWavOk = !wav || wav->close();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+    double emulated = nFrames / FRAME_RATE;
+    std::cout << "Ran " << nFrames << " frames (" << std::fixed << std::setprecision(2) << emulated << " s) in "
+              << elapsed << " s, " << (elapsed > 0 ? nFrames / elapsed : 0.0) << " fps, "
+              << (elapsed > 0 ? emulated / elapsed : 0.0) << "x real time, " << nes.LagFrameCount() << " lag frames" << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+    times.print(std::cout);
+    if (wav && bWavOk) std::cout << "Wrote " << wav->SampleCount() << " samples to " << opt.sWavFile << std::endl;
+    else if (wav) std::cerr << "Failed to write " << opt.sWavFile << std::endl;
+
+    if (!opt.sRecordFile.empty() && !recording.save(opt.sRecordFile)) {
+        std::cerr << "Failed to save movie " << opt.sRecordFile << std::endl;
+        return 1;
+    }
+    return bWavOk ? 0 : 1;
+}
+
+// NSF music player: runs only the CPU and APU, either into a WAV file as
+// fast as possible or to the audio device for the requested duration
+static int playNSF(Bus& nes, const Options& opt) {
+    const Cartridge::NSFInfo& info = nes.cart->nsf;
+    int track = opt.nTrack > 0 ? opt.nTrack : info.nStartSong;
+    if (track < 1 || track > info.nSongs) {
+        std::cerr << "Track " << track << " out of range (1-" << (int)info.nSongs << ")" << std::endl;
+        return 1;
+    }
+
+    NsfPlayer player(&nes);
+    nes.setAudioSampleRate(SAMPLE_RATE);
+    player.startTrack((uint8_t)track);
+    nes.audioBuffer.clear();
+
+    double seconds = opt.nFrames >= 0 ? opt.nFrames / FRAME_RATE : (opt.dSeconds >= 0.0 ? opt.dSeconds : 60.0);
+    uint64_t nTotalCycles = (uint64_t)(seconds * 1789773.0);
+    const uint32_t nChunk = 1789773 / 60;
+    std::cout << "Playing track " << track << " of " << (int)info.nSongs << std::endl;
+
+    if (!opt.sWavFile.empty()) {
+        WavWriter wav(opt.sWavFile, SAMPLE_RATE);
+        if (!wav.IsOpen()) {
+            std::cerr << "Failed to open " << opt.sWavFile << std::endl;
+            return 1;
+        }
+
+        auto tStart = std::chrono::steady_clock::now();
+        for (uint64_t done = 0; done < nTotalCycles; done += nChunk) {
+            player.run((uint32_t)std::min<uint64_t>(nChunk, nTotalCycles - done));
+            wav.write(nes.audioBuffer.data(), nes.audioBuffer.size());
+            nes.audioBuffer.clear();
+        }
+        if (!wav.close()) {
+            std::cerr << "Failed to write " << opt.sWavFile << std::endl;
+            return 1;
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+        std::cout << "Rendered " << std::fixed << std::setprecision(2) << seconds << " s in " << elapsed << " s, "
+                  << (elapsed > 0 ? seconds / elapsed : 0.0) << "x real time" << std::endl;
+        return 0;
+    }
+
+    if (SDL_Init(SDL_INIT_AUDIO) < 0) return 1;
+
+    SDL_AudioSpec want, have;
+    SDL_zero(want);
+    want.freq = SAMPLE_RATE;
+    want.format = AUDIO_F32;
+    want.channels = 1;
+    want.samples = 1024;
+    want.callback = NULL;
+
+    SDL_AudioDeviceID audioDevice = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+    if (audioDevice == 0) {
+        std::cerr << "Failed to open audio: " << SDL_GetError() << std::endl;
+        return 1;
+    }
+    SDL_PauseAudioDevice(audioDevice, 0);
+    nes.setAudioSampleRate(have.freq);
+
+    for (uint64_t done = 0; done < nTotalCycles; done += nChunk) {
+        player.run(nChunk);
+        SDL_QueueAudio(audioDevice, nes.audioBuffer.data(), nes.audioBuffer.size() * sizeof(float));
+        nes.audioBuffer.clear();
+
+        // Keep roughly 100ms queued
+        while (SDL_GetQueuedAudioSize(audioDevice) > have.freq / 10 * sizeof(float)) {
+            SDL_Delay(5);
+        }
+    }
+
+    SDL_CloseAudioDevice(audioDevice);
+    SDL_Quit();
+    return 0;
+}
+
+// Run-ahead: emulate the real frame (audio only), snapshot it, then emulate
+// nFrames - 1 hidden frames and one visible frame with the same input, and
+// roll back. The game's reaction to new input appears nFrames sooner. Only
+// the real frame goes into the CPU trace.
+// Returns false if the real frame could not be saved, or could not be
+// restored, in which case the machine is left at the frame shown.
+static bool clockFrameRunAhead(Bus& nes, int nFrames, std::vector<uint8_t>& state, InstructionTrace* cpuTrace) {
+    nes.ppu.setVideoOutput(false);
+    nes.clockFrame();
+
+    size_t size = nes.saveState(state.data(), state.size());
+    if (size == 0) {
+        nes.ppu.setVideoOutput(true);
+        return false;
+    }
+    nes.setAudioOutput(false);
+    nes.cpu.attachInstructionTrace(nullptr);
+    for (int i = 1; i < nFrames; i++) {
+        nes.clockFrame();
+    }
+    nes.ppu.setVideoOutput(true);
+    nes.clockFrame();
+    nes.setAudioOutput(true);
+    nes.cpu.attachInstructionTrace(cpuTrace);
+
+    return nes.loadState(state.data(), size);
+}
 
 int main(int argc, char* argv[]) {
+    Options opt;
+    if (!parseOptions(argc, argv, opt)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
     Bus nes;
-    std::shared_ptr<Cartridge> cart = std::make_shared<Cartridge>("mario.nes");
+    std::shared_ptr<Cartridge> cart = std::make_shared<Cartridge>(opt.sRomFile);
 
     if (!cart->ImageValid()) {
         std::cerr << "Failed to load ROM" << std::endl;
         return 1;
     }
+    if (cart->IsNSF()) {
+        const Cartridge::NSFInfo& info = cart->nsf;
+        std::cout << "NSF Loaded: " << info.sTitle << " - " << info.sArtist << " (" << (int)info.nSongs << " songs)" << std::endl;
+        if (info.nExtraChips) std::cout << "Expansion audio is not supported, tracks may sound incomplete" << std::endl;
+    } else {
+        std::cout << "ROM Loaded: " << opt.sRomFile << std::endl;
+        std::cout << "PRG Banks: " << (int)cart->PRGBanks() << " CHR Banks: " << (int)cart->CHRBanks() << " Mapper: " << (int)cart->MapperID() << std::endl;
+    }
 
     nes.insertCartridge(cart);
     nes.reset();
 
+#ifdef NES_PROFILER
+    std::unique_ptr<Profiler> profiler;
+    if (!opt.sProfileFile.empty()) {
+        profiler = std::make_unique<Profiler>();
+        profiler->reset(nes.cpu.pc);
+        nes.cpu.attachProfiler(profiler.get());
+    }
+#else
+    if (!opt.sProfileFile.empty()) {
+        std::cerr << "--profile needs a build configured with -DNES_PROFILER=ON" << std::endl;
+        return 1;
+    }
+#endif
+
+#ifdef NES_HEATMAP
+    std::unique_ptr<Heatmap> heatmap;
+    if (!opt.sHeatmapPrefix.empty()) {
+        heatmap = std::make_unique<Heatmap>();
+        nes.attachHeatmap(heatmap.get());
+    }
+#else
+    if (!opt.sHeatmapPrefix.empty()) {
+        std::cerr << "--heatmap needs a build configured with -DNES_HEATMAP=ON" << std::endl;
+        return 1;
+    }
+#endif
+
+    std::unique_ptr<Trace> trace;
+    if (!opt.sTraceFile.empty()) {
+        trace = std::make_unique<Trace>();
+        if (!trace->open(opt.sTraceFile)) {
+            std::cerr << "Failed to open " << opt.sTraceFile << std::endl;
+            return 1;
+        }
+        nes.attachTrace(trace.get());
+    }
+
+    std::unique_ptr<InstructionTrace> cpuTrace;
+    if (!opt.sCpuTraceFile.empty()) {
+        cpuTrace = std::make_unique<InstructionTrace>();
+        if (!cpuTrace->open(opt.sCpuTraceFile)) {
+            std::cerr << "Failed to open " << opt.sCpuTraceFile << std::endl;
+            return 1;
+        }
+        nes.cpu.attachInstructionTrace(cpuTrace.get());
+    }
+
+    // Every way out of a run writes the profile report, traces and heatmap
+    auto finish = [&](int result) {
+        if (cpuTrace) {
+            nes.cpu.attachInstructionTrace(nullptr);
+            cpuTrace->close();
+            std::cout << "Wrote " << cpuTrace->RecordCount() << " instructions to " << opt.sCpuTraceFile << std::endl;
+        }
+        if (trace) {
+            nes.attachTrace(nullptr);
+            trace->close();
+            std::cout << "Wrote trace to " << opt.sTraceFile << std::endl;
+        }
+#ifdef NES_PROFILER
+        if (profiler) {
+            std::ofstream ofs(opt.sProfileFile);
+            profiler->report(ofs, nes);
+            if (ofs.good()) std::cout << "Wrote profile to " << opt.sProfileFile << std::endl;
+            else std::cerr << "Failed to write " << opt.sProfileFile << std::endl;
+        }
+#endif
+#ifdef NES_HEATMAP
+        if (heatmap) {
+            std::string sCsv = opt.sHeatmapPrefix + ".csv";
+            std::ofstream ofs(sCsv);
+            heatmap->writeCSV(ofs);
+            bool ok = ofs.good() && heatmap->writeCpuPNG(opt.sHeatmapPrefix + "_cpu.png")
+                      && heatmap->writePpuPNG(opt.sHeatmapPrefix + "_ppu.png");
+            if (ok) std::cout << "Wrote heatmap of " << heatmap->Frames() << " frames to " << sCsv << ", "
+                              << opt.sHeatmapPrefix << "_cpu.png and " << opt.sHeatmapPrefix << "_ppu.png" << std::endl;
+            else std::cerr << "Failed to write heatmap " << opt.sHeatmapPrefix << std::endl;
+        }
+#endif
+        return result;
+    };
+
+    if (cart->IsNSF()) return finish(playNSF(nes, opt));
+    if (opt.bHeadless || !opt.sWavFile.empty()) return finish(runHeadless(nes, opt, trace.get()));
+
     // SDL Setup
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) return 1;
 
@@ -32,7 +436,7 @@ int main(int argc, char* argv[]) {
         SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 
         256 * 3, 240 * 3, SDL_WINDOW_SHOWN);
         
-    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | (opt.bVsync ? SDL_RENDERER_PRESENTVSYNC : 0));
     SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, 
         SDL_TEXTUREACCESS_STREAMING, 256, 240);
         
@@ -42,7 +446,7 @@ int main(int argc, char* argv[]) {
     want.freq = SAMPLE_RATE;
     want.format = AUDIO_F32;
     want.channels = 1;
-    want.samples = 1024;
+    want.samples = 512;
     want.callback = NULL; // Use queueing
 
     SDL_AudioDeviceID audioDevice = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
@@ -52,33 +456,77 @@ int main(int argc, char* argv[]) {
     }
     SDL_PauseAudioDevice(audioDevice, 0);
 
+    FramePacer pacer(have.freq, have.samples, [&]() {
+        return (uint32_t)(SDL_GetQueuedAudioSize(audioDevice) / sizeof(float));
+    });
+
+    // Vsync pacing only works if the display runs close to the NES rate
+    if (opt.bVsync) {
+        SDL_RendererInfo info;
+        SDL_DisplayMode display;
+        bool bHasVsync = SDL_GetRendererInfo(renderer, &info) == 0 && (info.flags & SDL_RENDERER_PRESENTVSYNC);
+        bool b60Hz = SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &display) == 0
+                     && display.refresh_rate >= 59 && display.refresh_rate <= 61;
+        if (bHasVsync && b60Hz) pacer.setMode(FramePacer::Mode::VSYNC);
+        else std::cout << "Vsync unavailable or display not at 60 Hz, pacing by audio" << std::endl;
+    }
+
     bool quit = false;
     bool debug = false;
     SDL_Event event;
-    
-    std::vector<float> audioBuffer;
-    audioBuffer.reserve(SAMPLES_PER_FRAME);
-    
-    // Timing for Audio Sync (replaces simple Delay)
-    // CPU runs at 1.789773 MHz. Audio at 44100 Hz.
-    // Samples per CPU cycle = 44100 / 1789773 = ~0.0246
-    // Or CPU cycles per sample = ~40.58
-    double sample_accumulator = 0;
-    double cpu_cycles_per_sample = 1789773.0 / 44100.0;
+
+    // Quick save slot (F5 save, F7 load), mirrored to <rom>.state
+    std::vector<uint8_t> saveSlot(64 * 1024);
+    std::string sStateFile = opt.sRomFile + ".state";
+
+    // Movie playback takes over the controllers until the movie ends
+    Movie movie;
+    if (!opt.sPlayFile.empty() && !startMovie(movie, nes, opt)) return 1;
+    Movie recording;
+    bool bRecording = !opt.sRecordFile.empty();
+    if (bRecording) recording.startRecording(nes);
+
+    // Hold Backspace to rewind (not while a movie is playing or recording)
+    Rewind rewind;
+    std::vector<uint8_t> runAheadState(64 * 1024);
+
+    // Set when the window needs presenting even if the image is unchanged
+    bool bRedraw = true;
+    // Set when every row changed in the last frame (scrolling), so the next
+    // one is likely to change every row as well
+    bool bAllDirty = false;
+    FrameTimes times;
 
     while (!quit) {
-        uint32_t frameStart = SDL_GetTicks();
+        Trace::Span frameSpan(trace.get(), "Frame");
+        pacer.beginFrame();
+        auto tFrame = std::chrono::steady_clock::now();
         
         // Handle Input
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_QUIT) quit = true;
+            if (event.type == SDL_WINDOWEVENT) bRedraw = true;
             if (event.type == SDL_KEYDOWN) {
                 if (event.key.keysym.sym == SDLK_ESCAPE) quit = true;
                 if (event.key.keysym.sym == SDLK_d) debug = !debug;
+                if (event.key.keysym.sym == SDLK_h) times.print(std::cout);
+                if (event.key.keysym.sym == SDLK_F5) {
+                    size_t size = nes.saveState(saveSlot.data(), saveSlot.size());
+                    std::ofstream ofs(sStateFile, std::ofstream::binary);
+                    ofs.write((const char*)saveSlot.data(), size);
+                    std::cout << "Saved state (" << size << " bytes) to " << sStateFile << std::endl;
+                }
+                if (event.key.keysym.sym == SDLK_F7 && !bRecording) {
+                    std::ifstream ifs(sStateFile, std::ifstream::binary);
+                    std::vector<uint8_t> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+                    if (nes.loadState(data.data(), data.size())) std::cout << "Loaded state from " << sStateFile << std::endl;
+                    else std::cerr << "Failed to load state from " << sStateFile << std::endl;
+                }
             }
         }
         
         const uint8_t* state = SDL_GetKeyboardState(NULL);
+        auto tInput = std::chrono::steady_clock::now();
         nes.controller[0] = 0x00;
         nes.controller[0] |= state[SDL_SCANCODE_X] ? 0x80 : 0x00; // A
         nes.controller[0] |= state[SDL_SCANCODE_Z] ? 0x40 : 0x00; // B
@@ -88,65 +536,135 @@ int main(int argc, char* argv[]) {
         nes.controller[0] |= state[SDL_SCANCODE_DOWN] ? 0x04 : 0x00;
         nes.controller[0] |= state[SDL_SCANCODE_LEFT] ? 0x02 : 0x00;
         nes.controller[0] |= state[SDL_SCANCODE_RIGHT] ? 0x01 : 0x00;
+        nes.controller[1] = 0x00;
+
+        bool bPlaying = movie.nextFrame(nes);
+        bool bRewinding = state[SDL_SCANCODE_BACKSPACE] && !bPlaying && !bRecording;
+        if (bRecording) recording.record(nes);
 
         if (debug) {
-             std::cout << "PC: " << std::hex << std::uppercase << std::setw(4) << std::setfill('0') << nes.cpu->pc
-                       << ", A: " << std::setw(2) << (int)nes.cpu->a
-                       << ", X: " << std::setw(2) << (int)nes.cpu->x
-                       << ", Y: " << std::setw(2) << (int)nes.cpu->y
-                       << ", Status: " << std::setw(2) << (int)nes.cpu->status
+#ifdef NES_PERF_COUNTERS
+             nes.FrameCounters().print(std::cout);
+#else
+             std::cout << "PC: " << std::hex << std::uppercase << std::setw(4) << std::setfill('0') << nes.cpu.pc
+                       << ", A: " << std::setw(2) << (int)nes.cpu.a
+                       << ", X: " << std::setw(2) << (int)nes.cpu.x
+                       << ", Y: " << std::setw(2) << (int)nes.cpu.y
+                       << ", Status: " << std::setw(2) << (int)nes.cpu.status
                        << std::dec << std::endl;
+#endif
         }
 
-        // Emulation Step
-        for (int i = 0; i < 89342; i++) { // PPU Cycles per frame
-             nes.clock();
-             
-             // Audio Sampling
-             // APU now runs at CPU clock (1.79MHz).
-             // We want 44.1kHz.
-             // CPU cycles per sample = 1789773 / 44100 = ~40.58
-             
-             // Bus::clock runs at PPU speed (3x CPU).
-             // So we increment accumulator by 1.0 for every PPU cycle?
-             // No, APU state updates every 3 PPU cycles.
-             // If we sample every PPU cycle, we oversample.
-             // We should sample based on PPU time.
-             
-             sample_accumulator += 1.0; // 1 PPU cycle
-             // PPU Clock / Sample Rate = 5369318 / 44100 = 121.75
-             
-             if (sample_accumulator >= 121.75) {
-                 sample_accumulator -= 121.75;
-                 float sample = (float)nes.apu->GetOutputSample();
-                 audioBuffer.push_back(sample);
-             }
+        // Emulation Step. After a frame that changed every row, the PPU
+        // draws straight into the locked streaming texture and the copy is
+        // skipped. A locked texture's old contents are undefined, so it is
+        // only locked when a whole frame is going to be drawn.
+        nes.setAudioSampleRate(pacer.AudioSampleRate());
+        void* pixels = nullptr;
+        int pitch = 0;
+        bool bDraw = !bRewinding || rewind.Frames() > 0;
+        bool bLocked = bAllDirty && bDraw && SDL_LockTexture(texture, NULL, &pixels, &pitch) == 0;
+        if (bLocked) {
+            nes.ppu.setRenderTarget(pixels, pitch);
+            nes.ppu.clearDirtyRows();   // Only the rows this frame changes
+        }
+        auto tEmulate = std::chrono::steady_clock::now();
+        if (bRewinding) {
+            // Step back one captured frame and replay it silently, the
+            // silence keeps the audio clock running for the pacer
+            Trace::Span span(trace.get(), "Emulate");
+            if (rewind.pop(nes)) nes.clockFrame();
+            nes.audioBuffer.assign((size_t)(pacer.AudioSampleRate() / FRAME_RATE), 0.0f);
+        } else {
+            Trace::Span span(trace.get(), "Emulate");
+            rewind.push(nes);
+            if (opt.nRunAhead == 0) nes.clockFrame();
+            else if (!clockFrameRunAhead(nes, opt.nRunAhead, runAheadState, cpuTrace.get())) {
+                std::cerr << "Run-ahead could not save or restore the state, turning it off" << std::endl;
+                opt.nRunAhead = 0;
+            }
+        }
+        times.hEmulate.record(FrameTimes::since(tEmulate));
+
+        // The texture holds the whole frame; the next frame draws every row
+        // into GetScreen() again, so only its changed rows need uploading
+        if (bLocked) {
+            const bool* dirty = nes.ppu.DirtyRows();
+            bAllDirty = std::all_of(dirty, dirty + 240, [](bool b) { return b; });
+            nes.ppu.setRenderTarget(nullptr, 0);
+            nes.ppu.clearDirtyRows();
+            SDL_UnlockTexture(texture);
+            bRedraw = true;
         }
         
         // Queue Audio
-        if (SDL_GetQueuedAudioSize(audioDevice) < 4096 * 4) { // Don't buffer too much to avoid latency
-             SDL_QueueAudio(audioDevice, audioBuffer.data(), audioBuffer.size() * sizeof(float));
+        {
+            Trace::Span span(trace.get(), "Queue audio");
+            pacer.audioQueued();
+            if (SDL_GetQueuedAudioSize(audioDevice) / sizeof(float) < pacer.MaxQueuedSamples()) { // Don't buffer too much to avoid latency
+                SDL_QueueAudio(audioDevice, nes.audioBuffer.data(), nes.audioBuffer.size() * sizeof(float));
+            }
+            nes.audioBuffer.clear();
+        }
+
+        // Draw: upload only the runs of rows that changed. An unchanged frame
+        // is not redrawn at all, unless vsync pacing relies on the present.
+        if (!bLocked) {
+            Trace::Span span(trace.get(), "Upload texture");
+            const bool* dirty = nes.ppu.DirtyRows();
+            bAllDirty = bDraw && std::all_of(dirty, dirty + 240, [](bool b) { return b; });
+            const uint32_t* screen = nes.ppu.GetScreen();
+            for (int y = 0; y < 240;) {
+                if (!dirty[y]) { y++; continue; }
+                int first = y;
+                while (y < 240 && dirty[y]) y++;
+                SDL_Rect rows = { 0, first, 256, y - first };
+                SDL_UpdateTexture(texture, &rows, screen + first * 256, 256 * sizeof(uint32_t));
+                bRedraw = true;
+            }
+            nes.ppu.clearDirtyRows();
         }
-        audioBuffer.clear();
 
-        // Draw
-        SDL_UpdateTexture(texture, NULL, nes.ppu->GetScreen(), 256 * sizeof(uint32_t));
-        SDL_RenderCopy(renderer, texture, NULL, NULL);
-        SDL_RenderPresent(renderer);
+        if (bRedraw || pacer.GetMode() == FramePacer::Mode::VSYNC) {
+            Trace::Span span(trace.get(), "Present");
+            auto tPresent = std::chrono::steady_clock::now();
+            SDL_RenderCopy(renderer, texture, NULL, NULL);
+            SDL_RenderPresent(renderer);
+            times.hPresent.record(FrameTimes::since(tPresent));
+            times.hLatency.record(FrameTimes::since(tInput));
+            bRedraw = false;
+        }
+        times.hFrame.record(FrameTimes::since(tFrame));
         
-        // Sync using Audio Queue instead of Delay if possible, or hybrid
-        // Basic Delay Sync
-        uint32_t frameTime = SDL_GetTicks() - frameStart;
-        if (frameTime < 16) {
-            SDL_Delay(16 - frameTime);
+        // Wait for the audio clock (or rely on vsync having blocked in present)
+        {
+            Trace::Span span(trace.get(), "Pace");
+            pacer.endFrame();
+        }
+
+        FramePacer::Stats& stats = pacer.GetStats();
+        if (stats.updated) {
+            stats.updated = false;
+            char title[192];
+            snprintf(title, sizeof(title), "NES Emulator - %.2f fps | frame %.1f ms (max %.1f) | audio %.0f ms (target %.0f) | underruns %u | lag %llu",
+                     stats.fps, stats.frameTimeAvgMs, stats.frameTimeMaxMs, stats.audioLatencyMs, stats.targetLatencyMs, stats.underruns,
+                     (unsigned long long)nes.LagFrameCount());
+            SDL_SetWindowTitle(window, title);
         }
     }
 
+    times.print(std::cout);
+
+    if (bRecording) {
+        if (recording.save(opt.sRecordFile)) std::cout << "Recorded " << recording.FrameCount() << " frames to " << opt.sRecordFile << std::endl;
+        else std::cerr << "Failed to save movie " << opt.sRecordFile << std::endl;
+    }
+
     SDL_CloseAudioDevice(audioDevice);
     SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
 
-    return 0;
+    return finish(0);
 }
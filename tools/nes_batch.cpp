@@ -0,0 +1,182 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Bus.h"
+#include "PPU.h"
+#include "Cartridge.h"
+#include "Movie.h"
+#include "Hash.h"
+#include "ThreadPool.h"
+
+// Runs many independent playthroughs in parallel. Each job is one line of
+// the job file:
+//
+//   <rom> [movie | -] [frames]
+//
+// Frames defaults to the movie length, or 600 without a movie. Every job
+// gets its own Bus, so jobs share nothing and run on all cores. The final
+// frame and RAM hashes identify the end state for regression checks.
+
+namespace {
+    const long DEFAULT_FRAMES = 600;
+
+    struct Job {
+        std::string sRom;
+        std::string sMovie;
+        long nFrames = -1;
+    };
+
+    struct Result {
+        bool bOk = false;
+        std::string sError;
+        long nFrames = 0;
+        uint64_t nLagFrames = 0;
+        uint64_t nFrameHash = 0;
+        uint64_t nRamHash = 0;
+        double dSeconds = 0.0;
+    };
+
+    // The whole string as a decimal number
+    bool parseNumber(const std::string& s, long& value) {
+        char* end = nullptr;
+        value = std::strtol(s.c_str(), &end, 10);
+        return !s.empty() && *end == '\0';
+    }
+
+    bool readJobs(const std::string& sFileName, std::vector<Job>& jobs) {
+        std::ifstream ifs(sFileName);
+        if (!ifs.is_open()) {
+            std::cerr << "Failed to open " << sFileName << std::endl;
+            return false;
+        }
+
+        std::string line;
+        for (int nLine = 1; std::getline(ifs, line); nLine++) {
+            std::istringstream ss(line);
+            Job job;
+            if (!(ss >> job.sRom) || job.sRom[0] == '#') continue;
+            std::string movie, frames;
+            if (ss >> movie && movie != "-") job.sMovie = movie;
+            if (ss >> frames && !parseNumber(frames, job.nFrames)) {
+                std::cerr << sFileName << ":" << nLine << ": frame count \"" << frames << "\" is not a number" << std::endl;
+                return false;
+            }
+            jobs.push_back(job);
+        }
+        return true;
+    }
+
+    void runJob(const Job& job, Result& result) {
+        auto tStart = std::chrono::steady_clock::now();
+
+        auto cart = std::make_shared<Cartridge>(job.sRom);
+        if (!cart->ImageValid() || cart->IsNSF()) {
+            result.sError = "failed to load ROM";
+            return;
+        }
+        Bus nes;
+        nes.insertCartridge(cart);
+        nes.reset();
+        nes.setAudioOutput(false);
+
+        Movie movie;
+        if (!job.sMovie.empty()) {
+            if (!movie.load(job.sMovie)) {
+                result.sError = "failed to load movie";
+                return;
+            }
+            if (!movie.start(nes)) {
+                result.sError = "movie does not match ROM";
+                return;
+            }
+        }
+
+        long nFrames = job.nFrames;
+        if (nFrames < 0) nFrames = job.sMovie.empty() ? DEFAULT_FRAMES : (long)movie.FrameCount();
+
+        // Only the last frame is drawn, it is the one that gets hashed
+        nes.ppu.setVideoOutput(false);
+        for (long frame = 0; frame < nFrames; frame++) {
+            if (!movie.nextFrame(nes)) {
+                nes.controller[0] = 0x00;
+                nes.controller[1] = 0x00;
+            }
+            if (frame == nFrames - 1) nes.ppu.setVideoOutput(true);
+            nes.clockFrame();
+        }
+
+        result.bOk = true;
+        result.nFrames = nFrames;
+        result.nLagFrames = nes.LagFrameCount();
+        result.nFrameHash = Hash::hash64(nes.ppu.GetScreen(), 256 * 240 * sizeof(uint32_t));
+        result.nRamHash = Hash::hash64(nes.cpuRam.data(), nes.cpuRam.size());
+        result.dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+    }
+
+    void printUsage(const char* name) {
+        std::cout << "Usage: " << name << " <jobs.txt> [options]\n"
+                  << "  --threads <n>      Worker threads (default: one per hardware thread)\n"
+                  << "Each line of the job file is: <rom> [movie | -] [frames]\n";
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string sJobFile;
+    unsigned nThreads = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        long value = 0;
+        if (arg == "--threads" && i + 1 < argc && parseNumber(argv[++i], value)) nThreads = (unsigned)std::max(0L, value);
+        else if (arg.size() > 1 && arg[0] == '-') { printUsage(argv[0]); return 1; }
+        else sJobFile = arg;
+    }
+    if (sJobFile.empty()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::vector<Job> jobs;
+    if (!readJobs(sJobFile, jobs)) return 1;
+
+    std::vector<Result> results(jobs.size());
+    auto tStart = std::chrono::steady_clock::now();
+    {
+        ThreadPool pool(nThreads);
+        for (size_t i = 0; i < jobs.size(); i++) {
+            pool.submit([&, i] { runJob(jobs[i], results[i]); });
+        }
+        pool.wait();
+        std::cerr << "Ran " << jobs.size() << " jobs on " << pool.ThreadCount() << " threads" << std::endl;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+    // One line per job, in job file order
+    long nTotalFrames = 0;
+    int nFailed = 0;
+    std::cout << "job\trom\tmovie\tframes\tlag_frames\tframe_hash\tram_hash\tseconds\n";
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const Result& r = results[i];
+        std::cout << i << "\t" << jobs[i].sRom << "\t" << (jobs[i].sMovie.empty() ? "-" : jobs[i].sMovie) << "\t";
+        if (!r.bOk) {
+            std::cout << "error: " << r.sError << "\n";
+            nFailed++;
+            continue;
+        }
+        std::cout << r.nFrames << "\t" << r.nLagFrames << "\t" << std::hex << std::setfill('0') << std::setw(16) << r.nFrameHash << "\t"
+                  << std::setw(16) << r.nRamHash << std::dec << std::setfill(' ') << "\t"
+                  << std::fixed << std::setprecision(3) << r.dSeconds << "\n";
+        nTotalFrames += r.nFrames;
+    }
+
+    std::cerr << std::fixed << std::setprecision(2) << nTotalFrames << " frames in " << elapsed << " s, "
+              << (elapsed > 0 ? nTotalFrames / elapsed : 0.0) << " fps aggregate";
+    if (nFailed) std::cerr << ", " << nFailed << " failed";
+    std::cerr << std::endl;
+    return nFailed ? 1 : 0;
+}
@@ -0,0 +1,251 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Bus.h"
+#include "CPU.h"
+#include "PPU.h"
+#include "APU.h"
+#include "Cartridge.h"
+#include "RomImage.h"
+
+// Microbenchmarks of the core hot paths on synthetic ROMs built in memory,
+// so results do not depend on any game. Each benchmark runs a warm up and
+// then --reps timed repetitions; the JSON on stdout gives the fastest and
+// the median time per operation, for comparing runs before and after a
+// change to the core.
+
+namespace {
+    // Sink for benchmark results so the work cannot be optimised away
+    volatile uint64_t nSink = 0;
+
+    const uint16_t SUBROUTINE_ADDR = 0xBE00;    // RTS, for the JSR benchmark
+    const uint16_t RTI_ADDR = 0xBF00;           // NMI and IRQ handler
+
+    // NROM-128 image: code repeated from $8000 and closed with a JMP back to
+    // the start, CHR ROM filled with opaque tiles so everything draws
+    std::shared_ptr<Cartridge> makeCartridge(const std::vector<uint8_t>& vBody) {
+        std::vector<uint8_t> vPrg(16384, 0xEA);
+        size_t nCopies = vBody.empty() ? 0 : 4096 / vBody.size();
+        size_t pos = 0;
+        for (size_t i = 0; i < nCopies; i++) {
+            std::copy(vBody.begin(), vBody.end(), vPrg.begin() + pos);
+            pos += vBody.size();
+        }
+        vPrg[pos] = 0x4C; vPrg[pos + 1] = 0x00; vPrg[pos + 2] = 0x80;    // JMP $8000
+        vPrg[SUBROUTINE_ADDR & 0x3FFF] = 0x60;
+        vPrg[RTI_ADDR & 0x3FFF] = 0x40;
+        auto vector = [&](uint16_t addr, uint16_t target) {
+            vPrg[addr & 0x3FFF] = target & 0xFF;
+            vPrg[(addr + 1) & 0x3FFF] = target >> 8;
+        };
+        vector(0xFFFA, RTI_ADDR);
+        vector(0xFFFC, 0x8000);
+        vector(0xFFFE, RTI_ADDR);
+
+        std::vector<uint8_t> vImage = { 'N', 'E', 'S', 0x1A, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+        vImage.insert(vImage.end(), vPrg.begin(), vPrg.end());
+        for (int i = 0; i < 8192; i++) vImage.push_back((i & 8) ? 0x55 : 0xFF);
+        return std::make_shared<Cartridge>(RomImage::fromMemory(std::move(vImage)));
+    }
+
+    std::unique_ptr<Bus> makeBus(const std::vector<uint8_t>& vBody = {}) {
+        std::unique_ptr<Bus> nes(new Bus());
+        nes->insertCartridge(makeCartridge(vBody));
+        nes->reset();
+        return nes;
+    }
+
+    struct Benchmark {
+        std::string sName;
+        std::string sUnit;          // What one operation is
+        uint64_t nOps;              // Operations per repetition
+        std::function<std::unique_ptr<Bus>()> setup;
+        std::function<void(Bus&, uint64_t)> run;
+    };
+
+    struct Result {
+        double dMinNs = 0.0;
+        double dMedianNs = 0.0;
+    };
+
+    Result measure(const Benchmark& b, uint64_t nOps, int nReps) {
+        std::vector<double> vNs;
+        for (int rep = -1; rep < nReps; rep++) {
+            std::unique_ptr<Bus> nes = b.setup();
+            auto t0 = std::chrono::steady_clock::now();
+            b.run(*nes, nOps);
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+            if (rep >= 0) vNs.push_back(ns / nOps);     // Rep -1 warms up
+        }
+        std::sort(vNs.begin(), vNs.end());
+        return { vNs.front(), vNs[vNs.size() / 2] };
+    }
+
+    // Bus::read/write over every address of a region
+    Benchmark busRead(const char* sName, uint16_t nBase, uint16_t nMask) {
+        return { sName, "read", 4000000, [] { return makeBus(); }, [=](Bus& nes, uint64_t nOps) {
+            uint64_t sum = 0;
+            for (uint64_t i = 0; i < nOps; i++) sum += nes.read((uint16_t)(nBase + (i & nMask)));
+            nSink = nSink + sum;
+        } };
+    }
+
+    Benchmark busWrite(const char* sName, uint16_t nBase, uint16_t nMask) {
+        return { sName, "write", 4000000, [] { return makeBus(); }, [=](Bus& nes, uint64_t nOps) {
+            for (uint64_t i = 0; i < nOps; i++) nes.write((uint16_t)(nBase + (i & nMask)), (uint8_t)i);
+        } };
+    }
+
+    // CPU::clock on a loop of one opcode family
+    Benchmark cpuFamily(const char* sName, std::vector<uint8_t> vBody) {
+        return { sName, "cpu_cycle", 4000000, [=] { return makeBus(vBody); }, [](Bus& nes, uint64_t nOps) {
+            for (uint64_t i = 0; i < nOps; i++) nes.cpu.clock();
+            nSink = nSink + nes.cpu.a;
+        } };
+    }
+
+    // PPU::clock for whole frames. mask is written to $2001; with bSprites
+    // the OAM holds 8x16 sprites stacked 8 per line over 128 scanlines.
+    Benchmark ppuFrame(const char* sName, uint8_t nMask, bool bSprites) {
+        auto setup = [=] {
+            std::unique_ptr<Bus> nes = makeBus();
+            nes->ppu.setOAMAddress(0);
+            for (int i = 0; i < 64; i++) {
+                nes->ppu.writeOAMData(bSprites ? (uint8_t)(16 + (i / 8) * 16) : 0xFF);
+                nes->ppu.writeOAMData(0x01);
+                nes->ppu.writeOAMData((uint8_t)(i & 0x03));
+                nes->ppu.writeOAMData((uint8_t)((i % 8) * 24));
+            }
+            nes->write(0x2000, bSprites ? 0x20 : 0x00);
+            nes->write(0x2001, nMask);
+            return nes;
+        };
+        return { sName, "frame", 60, setup, [](Bus& nes, uint64_t nOps) {
+            for (uint64_t i = 0; i < nOps * 341 * 262; i++) nes.ppu.clock();
+            nSink = nSink + nes.ppu.GetScreen()[256 * 120 + 128];
+        } };
+    }
+
+    // APU::clock and one output sample per CPU cycle with all channels on
+    Benchmark apuClock() {
+        auto setup = [] {
+            std::unique_ptr<Bus> nes = makeBus();
+            static const uint8_t REGS[][2] = {
+                { 0x15, 0x0F },
+                { 0x00, 0xBF }, { 0x02, 0xFD }, { 0x03, 0x00 },     // Pulse 1
+                { 0x04, 0x7F }, { 0x06, 0x80 }, { 0x07, 0x01 },     // Pulse 2
+                { 0x08, 0x81 }, { 0x0A, 0x40 }, { 0x0B, 0x01 },     // Triangle
+                { 0x0C, 0x3F }, { 0x0E, 0x05 }, { 0x0F, 0x00 },     // Noise
+            };
+            for (const auto& r : REGS) nes->apu.cpuWrite((uint16_t)(0x4000 | r[0]), r[1]);
+            return nes;
+        };
+        return { "apu_clock_sample", "cpu_cycle", 2000000, setup, [](Bus& nes, uint64_t nOps) {
+            double sum = 0.0;
+            for (uint64_t i = 0; i < nOps; i++) {
+                nes.apu.clock();
+                sum += nes.apu.GetOutputSample();
+            }
+            nSink = nSink + (uint64_t)sum;
+        } };
+    }
+
+    std::vector<Benchmark> allBenchmarks() {
+        uint8_t sub_lo = SUBROUTINE_ADDR & 0xFF, sub_hi = SUBROUTINE_ADDR >> 8;
+        return {
+            busRead("bus_read_ram", 0x0000, 0x1FFF),
+            busRead("bus_read_ppu", 0x2000, 0x1FFF),
+            busRead("bus_read_apu_io", 0x4000, 0x0017),
+            busRead("bus_read_cart", 0x8000, 0x7FFF),
+            busWrite("bus_write_ram", 0x0000, 0x1FFF),
+            busWrite("bus_write_ppu", 0x2000, 0x1FFF),
+            busWrite("bus_write_apu", 0x4000, 0x000F),
+            busWrite("bus_write_cart", 0x8000, 0x7FFF),
+
+            cpuFamily("cpu_load_store", { 0xAD, 0x00, 0x02, 0x8D, 0x01, 0x02, 0xA5, 0x10, 0x85, 0x11 }),   // LDA/STA abs, zp
+            cpuFamily("cpu_alu", { 0x69, 0x01, 0x29, 0xFF, 0x49, 0x55, 0xC9, 0x80, 0x65, 0x10 }),         // ADC/AND/EOR/CMP #, ADC zp
+            cpuFamily("cpu_shift", { 0x0A, 0x6A, 0x46, 0x10, 0x26, 0x10 }),                               // ASL A, ROR A, LSR/ROL zp
+            cpuFamily("cpu_inc_dec", { 0xE8, 0x88, 0xE6, 0x10, 0xCE, 0x00, 0x02 }),                       // INX, DEY, INC zp, DEC abs
+            cpuFamily("cpu_branch", { 0x18, 0x90, 0x00, 0x38, 0x90, 0x00 }),                              // BCC taken, not taken
+            cpuFamily("cpu_stack", { 0x48, 0x68, 0x08, 0x28 }),                                           // PHA, PLA, PHP, PLP
+            cpuFamily("cpu_jsr_rts", { 0x20, sub_lo, sub_hi }),
+            cpuFamily("cpu_indirect", { 0xB1, 0x10, 0x91, 0x12, 0xA1, 0x14 }),                            // LDA (zp),Y, STA (zp),Y, LDA (zp,X)
+
+            ppuFrame("ppu_frame_render_off", 0x00, false),
+            ppuFrame("ppu_frame_render_on", 0x1E, false),
+            ppuFrame("ppu_frame_8_sprites_per_line", 0x1E, true),
+
+            apuClock(),
+        };
+    }
+
+    // The whole string as a decimal number
+    bool parseNumber(const std::string& s, long& value) {
+        char* end = nullptr;
+        value = std::strtol(s.c_str(), &end, 10);
+        return !s.empty() && *end == '\0';
+    }
+
+    bool parseNumber(const std::string& s, double& value) {
+        char* end = nullptr;
+        value = std::strtod(s.c_str(), &end);
+        return !s.empty() && *end == '\0' && std::isfinite(value);
+    }
+
+    void printUsage(const char* name) {
+        std::cout << "Usage: " << name << " [options]\n"
+                  << "  --reps <n>         Timed repetitions per benchmark (default: 5)\n"
+                  << "  --filter <text>    Only run benchmarks whose name contains text\n"
+                  << "  --scale <x>        Multiply the operations per repetition (default: 1)\n"
+                  << "  --list             List the benchmarks\n";
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int nReps = 5;
+    double dScale = 1.0;
+    std::string sFilter;
+    bool bList = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        long value = 0;
+        double dValue = 0;
+        if (arg == "--reps" && i + 1 < argc && parseNumber(argv[++i], value) && value > 0) nReps = (int)std::min(value, 1000000L);
+        else if (arg == "--filter" && i + 1 < argc) sFilter = argv[++i];
+        else if (arg == "--scale" && i + 1 < argc && parseNumber(argv[++i], dValue) && dValue > 0) dScale = dValue;
+        else if (arg == "--list") bList = true;
+        else { printUsage(argv[0]); return 1; }
+    }
+
+    std::vector<Benchmark> vBenchmarks = allBenchmarks();
+    if (bList) {
+        for (const Benchmark& b : vBenchmarks) std::cout << b.sName << "\n";
+        return 0;
+    }
+
+    // Progress goes to stderr, stdout is only the JSON
+    std::cout << "{\n  \"reps\": " << nReps << ",\n  \"results\": [";
+    bool bFirst = true;
+    for (const Benchmark& b : vBenchmarks) {
+        if (!sFilter.empty() && b.sName.find(sFilter) == std::string::npos) continue;
+        // Clamped before the conversion, which is undefined out of range
+        uint64_t nOps = (uint64_t)std::min(std::max(1.0, b.nOps * dScale), 1e15);
+        Result r = measure(b, nOps, nReps);
+
+        char line[256];
+        snprintf(line, sizeof(line), "%s\n    {\"name\": \"%s\", \"unit\": \"%s\", \"ops\": %llu, \"ns_per_op_min\": %.3f, \"ns_per_op_median\": %.3f}",
+                 bFirst ? "" : ",", b.sName.c_str(), b.sUnit.c_str(), (unsigned long long)nOps, r.dMinNs, r.dMedianNs);
+        std::cout << line << std::flush;
+        fprintf(stderr, "%-30s %12.3f ns/%s\n", b.sName.c_str(), r.dMinNs, b.sUnit.c_str());
+        bFirst = false;
+    }
+    std::cout << "\n  ]\n}\n";
+    return 0;
+}
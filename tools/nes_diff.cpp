@@ -0,0 +1,294 @@
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Bus.h"
+#include "CPU.h"
+#include "PPU.h"
+#include "Cartridge.h"
+#include "Movie.h"
+#include "Hash.h"
+#include "SaveState.h"
+#include "InstructionTrace.h"
+
+// Differential test of two core configurations. Both run the same ROM and
+// input in lockstep; after every frame the hashes of RAM, CPU registers,
+// PPU state and the picture are compared. On the first difference the frame
+// is replayed clock by clock from snapshots taken at its start to find the
+// first instruction after which the CPU registers or RAM differ, and the
+// instructions leading up to it are printed.
+
+namespace {
+    enum class Mode { REF, STATE, CLONE, NOVIDEO, INDEX8 };
+
+    struct ConfigInfo {
+        const char* sName;
+        Mode mode;
+        const char* sDescription;
+    };
+
+    const ConfigInfo CONFIGS[] = {
+        { "ref", Mode::REF, "clockFrame() with video output (the reference)" },
+        { "state", Mode::STATE, "save state loaded into a new machine before every frame" },
+        { "clone", Mode::CLONE, "continue on Bus::clone() before every frame" },
+        { "novideo", Mode::NOVIDEO, "video output off, the picture is not compared" },
+        { "index8", Mode::INDEX8, "INDEX8 render target, compared through the palette" },
+    };
+
+    struct Hashes {
+        uint64_t nRam = 0, nCpu = 0, nPpu = 0, nFrame = 0;
+        bool bFrame = false;        // Whether the picture was hashed
+    };
+
+    uint64_t cpuHash(const CPU& cpu) {
+        uint8_t regs[8] = { cpu.a, cpu.x, cpu.y, cpu.stkp, (uint8_t)(cpu.pc & 0xFF), (uint8_t)(cpu.pc >> 8), cpu.status, cpu.cycles };
+        return Hash::hash64(regs, sizeof(regs));
+    }
+
+    // One configuration of the core with its own machine and movie playback
+    struct Side {
+        const ConfigInfo* config = nullptr;
+        std::unique_ptr<Bus> nes;
+        Movie movie;
+        std::vector<uint8_t> vIndexed;
+        std::vector<uint32_t> vArgb;
+        std::vector<uint8_t> vState;
+
+        bool init(const ConfigInfo* c, const std::string& sRom, const std::string& sMovie) {
+            config = c;
+            auto cart = std::make_shared<Cartridge>(sRom);
+            if (!cart->ImageValid() || cart->IsNSF()) {
+                std::cerr << "Failed to load ROM " << sRom << std::endl;
+                return false;
+            }
+            nes.reset(new Bus());
+            nes->insertCartridge(cart);
+            nes->reset();
+            if (!sMovie.empty() && (!movie.load(sMovie) || !movie.start(*nes))) {
+                std::cerr << "Failed to start movie " << sMovie << std::endl;
+                return false;
+            }
+            vState.resize(64 * 1024);
+            configure(*nes);
+            return true;
+        }
+
+        // Output settings of the configuration; clones start without them
+        void configure(Bus& bus) {
+            bus.setAudioOutput(false);
+            if (config->mode == Mode::NOVIDEO) bus.ppu.setVideoOutput(false);
+            if (config->mode == Mode::INDEX8) {
+                vIndexed.resize(256 * 240);
+                bus.ppu.setRenderTarget(vIndexed.data(), 256, PPU::PixelFormat::INDEX8);
+            }
+        }
+
+        // Copy of the machine with the configuration applied, for the replay
+        std::unique_ptr<Bus> snapshot() {
+            std::unique_ptr<Bus> copy = nes->clone();
+            configure(*copy);
+            return copy;
+        }
+
+        // Applies the configuration's between-frame step and sets the input
+        bool beginFrame() {
+            if (config->mode == Mode::STATE) {
+                size_t size = nes->saveState(vState.data(), vState.size());
+                std::unique_ptr<Bus> fresh(new Bus());
+                fresh->insertCartridge(nes->cart->clone());
+                if (!fresh->loadState(vState.data(), size)) {
+                    std::cerr << config->sName << ": failed to load the save state" << std::endl;
+                    return false;
+                }
+                nes = std::move(fresh);
+                configure(*nes);
+            } else if (config->mode == Mode::CLONE) {
+                nes = nes->clone();
+                configure(*nes);
+            }
+            if (!movie.nextFrame(*nes)) {
+                nes->controller[0] = 0x00;
+                nes->controller[1] = 0x00;
+            }
+            return true;
+        }
+
+        // ARGB picture of the last frame, or nullptr without video output
+        const uint32_t* Picture() {
+            if (config->mode == Mode::NOVIDEO) return nullptr;
+            if (config->mode != Mode::INDEX8) return nes->ppu.GetScreen();
+            const uint32_t* palette = nes->ppu.GetPalette();
+            vArgb.resize(256 * 240);
+            for (size_t i = 0; i < vArgb.size(); i++) vArgb[i] = palette[vIndexed[i] & 0x3F];
+            return vArgb.data();
+        }
+
+        Hashes hash() {
+            Hashes h;
+            h.nRam = Hash::hash64(nes->cpuRam.data(), nes->cpuRam.size());
+            h.nCpu = cpuHash(nes->cpu);
+            StateWriter state(vState.data(), vState.size());
+            nes->ppu.saveState(state);
+            h.nPpu = Hash::hash64(vState.data(), state.Size());
+            if (const uint32_t* picture = Picture()) {
+                h.nFrame = Hash::hash64(picture, 256 * 240 * sizeof(uint32_t));
+                h.bFrame = true;
+            }
+            return h;
+        }
+    };
+
+    InstructionTrace::Record capture(Bus& nes) {
+        InstructionTrace::Record r;
+        r.nCycle = nes.cpu.CycleCount();
+        r.pc = nes.cpu.pc;
+        r.scanline = nes.ppu.Scanline();
+        r.dot = (uint16_t)nes.ppu.Cycle();
+        for (int i = 0; i < 3; i++) r.bytes[i] = nes.read((uint16_t)(nes.cpu.pc + i), true);
+        r.a = nes.cpu.a;
+        r.x = nes.cpu.x;
+        r.y = nes.cpu.y;
+        r.status = nes.cpu.status;
+        r.stkp = nes.cpu.stkp;
+        return r;
+    }
+
+    bool sameState(const InstructionTrace::Record& a, const InstructionTrace::Record& b) {
+        return a.pc == b.pc && a.a == b.a && a.x == b.x && a.y == b.y && a.status == b.status && a.stkp == b.stkp
+               && a.scanline == b.scanline && a.dot == b.dot;
+    }
+
+    void printRecord(const char* sPrefix, const InstructionTrace::Record& r) {
+        uint8_t nLength = 0;
+        std::string sText = CPU::disassemble(r.pc, r.bytes, nLength);
+        printf("%s %04X  %-32sA:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3d,%3d\n", sPrefix, r.pc, sText.c_str(),
+               r.a, r.x, r.y, r.status, r.stkp, r.scanline < 0 ? 261 : r.scanline, r.dot);
+    }
+
+    // Replays one frame on both snapshots clock by clock and reports the
+    // first instruction boundary at which the CPU registers or RAM differ
+    bool locateInstruction(Bus& a, Bus& b, size_t nWindow) {
+        std::deque<InstructionTrace::Record> vHistory;
+        uint64_t nLastCycle = ~0ull;
+        for (int i = 0; i < 341 * 262; i++) {
+            a.clock();
+            b.clock();
+            // An instruction starts on the next CPU cycle once cycles is 0
+            if (a.cpu.cycles != 0 || a.cpu.CycleCount() == nLastCycle) continue;
+            nLastCycle = a.cpu.CycleCount();
+
+            InstructionTrace::Record ra = capture(a), rb = capture(b);
+            bool bRam = a.cpuRam != b.cpuRam;
+            if (sameState(ra, rb) && !bRam && b.cpu.cycles == 0) {
+                vHistory.push_back(ra);
+                if (vHistory.size() > nWindow) vHistory.pop_front();
+                continue;
+            }
+
+            printf("First difference after %zu instructions shown below (CPU cycle %llu):\n",
+                   vHistory.size(), (unsigned long long)ra.nCycle);
+            for (const auto& r : vHistory) printRecord(" ", r);
+            printRecord("A", ra);
+            printRecord("B", rb);
+            if (bRam) {
+                for (size_t addr = 0; addr < a.cpuRam.size(); addr++) {
+                    if (a.cpuRam[addr] == b.cpuRam[addr]) continue;
+                    printf("RAM $%04zX: A %02X, B %02X\n", addr, a.cpuRam[addr], b.cpuRam[addr]);
+                    break;
+                }
+            }
+            return true;
+        }
+        return false;
+    }
+
+    // The whole string as a decimal number
+    bool parseNumber(const std::string& s, long& value) {
+        char* end = nullptr;
+        value = std::strtol(s.c_str(), &end, 10);
+        return !s.empty() && *end == '\0';
+    }
+
+    void printUsage(const char* name) {
+        std::cout << "Usage: " << name << " <rom.nes> [options]\n"
+                  << "  --play <file>      Drive both machines with an input movie\n"
+                  << "  --frames <n>       Frames to compare (default: movie length or 600)\n"
+                  << "  --a <config>       First configuration (default: ref)\n"
+                  << "  --b <config>       Second configuration (default: state)\n"
+                  << "  --window <n>       Instructions shown before a difference (default: 16)\n"
+                  << "Configurations:\n";
+        for (const ConfigInfo& c : CONFIGS) printf("  %-19s%s\n", c.sName, c.sDescription);
+    }
+
+    const ConfigInfo* findConfig(const std::string& sName) {
+        for (const ConfigInfo& c : CONFIGS) {
+            if (sName == c.sName) return &c;
+        }
+        return nullptr;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string sRom, sMovie, sConfigA = "ref", sConfigB = "state";
+    long nFrames = -1;
+    size_t nWindow = 16;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        long value = 0;
+        if (arg == "--play" && hasValue) sMovie = argv[++i];
+        else if (arg == "--frames" && hasValue && parseNumber(argv[++i], value)) nFrames = value;
+        else if (arg == "--a" && hasValue) sConfigA = argv[++i];
+        else if (arg == "--b" && hasValue) sConfigB = argv[++i];
+        else if (arg == "--window" && hasValue && parseNumber(argv[++i], value)) nWindow = (size_t)std::max(0L, value);
+        else if (arg.size() > 1 && arg[0] == '-') { printUsage(argv[0]); return 1; }
+        else sRom = arg;
+    }
+    const ConfigInfo* configA = findConfig(sConfigA);
+    const ConfigInfo* configB = findConfig(sConfigB);
+    if (sRom.empty() || !configA || !configB) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    Side a, b;
+    if (!a.init(configA, sRom, sMovie) || !b.init(configB, sRom, sMovie)) return 1;
+    if (nFrames < 0) nFrames = sMovie.empty() ? 600 : (long)a.movie.FrameCount();
+
+    for (long frame = 0; frame < nFrames; frame++) {
+        if (!a.beginFrame() || !b.beginFrame()) return 1;
+        std::unique_ptr<Bus> snapA = a.snapshot(), snapB = b.snapshot();
+        a.nes->clockFrame();
+        b.nes->clockFrame();
+
+        Hashes ha = a.hash(), hb = b.hash();
+        bool bFrame = ha.bFrame && hb.bFrame && ha.nFrame != hb.nFrame;
+        if (ha.nRam == hb.nRam && ha.nCpu == hb.nCpu && ha.nPpu == hb.nPpu && !bFrame) continue;
+
+        printf("%s and %s diverge in frame %ld:", configA->sName, configB->sName, frame);
+        if (ha.nRam != hb.nRam) printf(" RAM");
+        if (ha.nCpu != hb.nCpu) printf(" CPU");
+        if (ha.nPpu != hb.nPpu) printf(" PPU");
+        if (bFrame) printf(" picture");
+        printf("\n");
+
+        if (!locateInstruction(*snapA, *snapB, nWindow)) {
+            printf("CPU registers and RAM match at every instruction of the frame\n");
+            const uint32_t* pa = a.Picture();
+            const uint32_t* pb = b.Picture();
+            for (int i = 0; bFrame && i < 256 * 240; i++) {
+                if (pa[i] == pb[i]) continue;
+                printf("First differing pixel (%d, %d): A %06X, B %06X\n", i % 256, i / 256, pa[i] & 0xFFFFFF, pb[i] & 0xFFFFFF);
+                break;
+            }
+        }
+        return 1;
+    }
+
+    printf("%s and %s match over %ld frames\n", configA->sName, configB->sName, nFrames);
+    return 0;
+}
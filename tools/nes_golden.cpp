@@ -0,0 +1,251 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Bus.h"
+#include "PPU.h"
+#include "Cartridge.h"
+#include "Movie.h"
+#include "Hash.h"
+#include "ThreadPool.h"
+
+// Golden output regression tests. Every frame of a headless run is reduced
+// to three 64 bit hashes (picture, RAM, audio samples), stored as one text
+// line of about 55 bytes, so 1000 frames are about 55 KB of reference data
+// instead of 1000 screenshots. Each line of the suite file is one run:
+//
+//   <golden> <rom> [movie | -] [frames]
+//
+// "record" writes the hash list of every run to its golden file, "check"
+// runs them again and reports the first frame that no longer matches.
+
+namespace {
+    const long DEFAULT_FRAMES = 600;
+    const double SAMPLE_RATE = 44100.0;
+
+    struct Job {
+        std::string sGolden;
+        std::string sRom;
+        std::string sMovie;
+        long nFrames = -1;
+    };
+
+    struct FrameHashes {
+        uint64_t nFrame = 0;
+        uint64_t nRam = 0;
+        uint64_t nAudio = 0;
+    };
+
+    struct Result {
+        bool bOk = false;
+        std::string sMessage;
+        long nFrames = 0;
+    };
+
+    // The whole string as a decimal number
+    bool parseNumber(const std::string& s, long& value) {
+        char* end = nullptr;
+        value = std::strtol(s.c_str(), &end, 10);
+        return !s.empty() && *end == '\0';
+    }
+
+    bool readSuite(const std::string& sFileName, std::vector<Job>& jobs) {
+        std::ifstream ifs(sFileName);
+        if (!ifs.is_open()) {
+            std::cerr << "Failed to open " << sFileName << std::endl;
+            return false;
+        }
+
+        std::string line;
+        for (int nLine = 1; std::getline(ifs, line); nLine++) {
+            std::istringstream ss(line);
+            Job job;
+            if (!(ss >> job.sGolden) || job.sGolden[0] == '#' || !(ss >> job.sRom)) continue;
+            std::string movie, frames;
+            if (ss >> movie && movie != "-") job.sMovie = movie;
+            if (ss >> frames && !parseNumber(frames, job.nFrames)) {
+                std::cerr << sFileName << ":" << nLine << ": frame count \"" << frames << "\" is not a number" << std::endl;
+                return false;
+            }
+            jobs.push_back(job);
+        }
+        return true;
+    }
+
+    bool runFrames(const Job& job, uint64_t& nRomHash, std::vector<FrameHashes>& hashes, std::string& sError) {
+        auto cart = std::make_shared<Cartridge>(job.sRom);
+        if (!cart->ImageValid() || cart->IsNSF()) {
+            sError = "failed to load ROM";
+            return false;
+        }
+        nRomHash = cart->RomHash();
+        Bus nes;
+        nes.insertCartridge(cart);
+        nes.reset();
+        nes.setAudioSampleRate(SAMPLE_RATE);
+
+        Movie movie;
+        if (!job.sMovie.empty() && (!movie.load(job.sMovie) || !movie.start(nes))) {
+            sError = "failed to start movie";
+            return false;
+        }
+
+        long nFrames = job.nFrames;
+        if (nFrames < 0) nFrames = job.sMovie.empty() ? DEFAULT_FRAMES : (long)movie.FrameCount();
+        hashes.resize((size_t)nFrames);
+        for (long frame = 0; frame < nFrames; frame++) {
+            if (!movie.nextFrame(nes)) {
+                nes.controller[0] = 0x00;
+                nes.controller[1] = 0x00;
+            }
+            nes.clockFrame();
+
+            FrameHashes& h = hashes[(size_t)frame];
+            h.nFrame = Hash::hash64(nes.ppu.GetScreen(), 256 * 240 * sizeof(uint32_t));
+            h.nRam = Hash::hash64(nes.cpuRam.data(), nes.cpuRam.size());
+            h.nAudio = Hash::hash64(nes.audioBuffer.data(), nes.audioBuffer.size() * sizeof(float));
+            nes.audioBuffer.clear();
+        }
+        return true;
+    }
+
+    // Text format, one line per frame: "<frame> <picture> <ram> <audio>"
+    // after a header naming the ROM, so golden files diff readably
+    bool writeGolden(const std::string& sFileName, uint64_t nRomHash, const std::vector<FrameHashes>& hashes) {
+        std::ofstream ofs(sFileName);
+        if (!ofs.is_open()) return false;
+        ofs << "nes_golden 1 " << std::hex << std::setfill('0') << std::setw(16) << nRomHash << std::dec << " " << hashes.size() << "\n";
+        char line[80];
+        for (size_t i = 0; i < hashes.size(); i++) {
+            snprintf(line, sizeof(line), "%zu %016llx %016llx %016llx\n", i, (unsigned long long)hashes[i].nFrame,
+                     (unsigned long long)hashes[i].nRam, (unsigned long long)hashes[i].nAudio);
+            ofs << line;
+        }
+        return ofs.good();
+    }
+
+    bool readGolden(const std::string& sFileName, uint64_t& nRomHash, std::vector<FrameHashes>& hashes) {
+        std::ifstream ifs(sFileName);
+        std::string sMagic;
+        int nVersion = 0;
+        size_t nFrames = 0;
+        if (!(ifs >> sMagic >> nVersion >> std::hex >> nRomHash >> std::dec >> nFrames) || sMagic != "nes_golden" || nVersion != 1) return false;
+
+        hashes.resize(nFrames);
+        for (size_t i = 0; i < nFrames; i++) {
+            size_t nIndex = 0;
+            FrameHashes& h = hashes[i];
+            if (!(ifs >> std::dec >> nIndex >> std::hex >> h.nFrame >> h.nRam >> h.nAudio) || nIndex != i) return false;
+        }
+        return true;
+    }
+
+    void runJob(const Job& job, bool bRecord, Result& result) {
+        uint64_t nRomHash = 0;
+        std::vector<FrameHashes> hashes;
+        if (!runFrames(job, nRomHash, hashes, result.sMessage)) return;
+        result.nFrames = (long)hashes.size();
+
+        if (bRecord) {
+            result.bOk = writeGolden(job.sGolden, nRomHash, hashes);
+            result.sMessage = result.bOk ? "recorded" : "failed to write " + job.sGolden;
+            return;
+        }
+
+        uint64_t nGoldenRom = 0;
+        std::vector<FrameHashes> golden;
+        if (!readGolden(job.sGolden, nGoldenRom, golden)) {
+            result.sMessage = "failed to read " + job.sGolden;
+            return;
+        }
+        if (nGoldenRom != nRomHash) {
+            result.sMessage = "golden file was recorded with a different ROM";
+            return;
+        }
+        if (golden.size() != hashes.size()) {
+            result.sMessage = "golden file has " + std::to_string(golden.size()) + " frames, ran " + std::to_string(hashes.size());
+            return;
+        }
+
+        // Report the first mismatch and how many frames differ in total
+        long nFirst = -1, nMismatched = 0;
+        std::string sParts;
+        for (size_t i = 0; i < hashes.size(); i++) {
+            bool bFrame = hashes[i].nFrame != golden[i].nFrame;
+            bool bRam = hashes[i].nRam != golden[i].nRam;
+            bool bAudio = hashes[i].nAudio != golden[i].nAudio;
+            if (!bFrame && !bRam && !bAudio) continue;
+            if (nFirst < 0) {
+                nFirst = (long)i;
+                if (bFrame) sParts += " picture";
+                if (bRam) sParts += " RAM";
+                if (bAudio) sParts += " audio";
+            }
+            nMismatched++;
+        }
+        if (nFirst >= 0) {
+            result.sMessage = "frame " + std::to_string(nFirst) + " differs in" + sParts + " (" + std::to_string(nMismatched) + " frames differ)";
+            return;
+        }
+        result.bOk = true;
+        result.sMessage = "ok";
+    }
+
+    void printUsage(const char* name) {
+        std::cout << "Usage: " << name << " <record | check> <suite.txt> [options]\n"
+                  << "  --threads <n>      Worker threads (default: one per hardware thread)\n"
+                  << "Each line of the suite file is: <golden> <rom> [movie | -] [frames]\n";
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string sMode, sSuiteFile;
+    unsigned nThreads = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        long value = 0;
+        if (arg == "--threads" && i + 1 < argc && parseNumber(argv[++i], value)) nThreads = (unsigned)std::max(0L, value);
+        else if (arg.size() > 1 && arg[0] == '-') { printUsage(argv[0]); return 1; }
+        else if (sMode.empty()) sMode = arg;
+        else sSuiteFile = arg;
+    }
+    if ((sMode != "record" && sMode != "check") || sSuiteFile.empty()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::vector<Job> jobs;
+    if (!readSuite(sSuiteFile, jobs)) return 1;
+
+    std::vector<Result> results(jobs.size());
+    auto tStart = std::chrono::steady_clock::now();
+    {
+        ThreadPool pool(nThreads);
+        for (size_t i = 0; i < jobs.size(); i++) {
+            pool.submit([&, i] { runJob(jobs[i], sMode == "record", results[i]); });
+        }
+        pool.wait();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+    // One line per run, in suite file order
+    long nTotalFrames = 0;
+    int nFailed = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const Result& r = results[i];
+        std::cout << (r.bOk ? "PASS" : "FAIL") << "\t" << jobs[i].sGolden << "\t" << r.nFrames << "\t" << r.sMessage << "\n";
+        nTotalFrames += r.nFrames;
+        if (!r.bOk) nFailed++;
+    }
+    std::cerr << std::fixed << std::setprecision(2) << jobs.size() << " runs, " << nTotalFrames << " frames in " << elapsed << " s";
+    if (nFailed) std::cerr << ", " << nFailed << " failed";
+    std::cerr << std::endl;
+    return nFailed ? 1 : 0;
+}
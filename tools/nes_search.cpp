@@ -0,0 +1,217 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "Bus.h"
+#include "PPU.h"
+#include "Cartridge.h"
+#include "Movie.h"
+#include "Hash.h"
+#include "ThreadPool.h"
+
+// Beam search over controller inputs. Every node of the beam is a complete
+// machine; each step clones every node once per action, holds the action
+// for a few frames and keeps the best scoring children. The score is a
+// weighted sum of RAM bytes, e.g. "--score 0x6D:256,0x86" for a 16 bit
+// position split over two bytes.
+
+namespace {
+    struct Term {
+        uint16_t nAddr = 0;
+        long nWeight = 1;
+    };
+
+    struct Node {
+        std::unique_ptr<Bus> bus;
+        std::vector<uint8_t> vPath;     // Action taken at each step
+        long nScore = 0;
+        uint64_t nRamHash = 0;
+    };
+
+    struct Options {
+        std::string sRomFile;
+        std::string sMovieFile;         // Start from the end of this movie
+        std::string sRecordFile;        // Best path as a movie
+        std::vector<Term> vScore;
+        std::vector<uint8_t> vActions = { 0x00, 0x80, 0x40, 0x01, 0x81, 0x41, 0x02, 0x82 };
+        uint32_t nBeam = 32;
+        uint32_t nDepth = 60;
+        uint32_t nHold = 8;
+        unsigned nThreads = 0;
+    };
+
+    bool parseList(const std::string& s, std::vector<std::string>& items) {
+        std::stringstream ss(s);
+        std::string item;
+        while (std::getline(ss, item, ',')) items.push_back(item);
+        return !items.empty();
+    }
+
+    // The whole string as a number; base 0 also takes 0x hex and 0 octal
+    bool parseNumber(const std::string& s, long& value, int base = 10) {
+        char* end = nullptr;
+        value = std::strtol(s.c_str(), &end, base);
+        return !s.empty() && *end == '\0';
+    }
+
+    bool parseOptions(int argc, char* argv[], Options& opt) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            long value = 0;
+            if (arg == "--score" && hasValue) {
+                std::vector<std::string> items;
+                parseList(argv[++i], items);
+                for (auto& item : items) {
+                    Term t;
+                    size_t colon = item.find(':');
+                    if (!parseNumber(item.substr(0, colon), value, 0) || value < 0 || value > 0x07FF) return false;
+                    t.nAddr = (uint16_t)value;
+                    if (colon != std::string::npos && !parseNumber(item.substr(colon + 1), t.nWeight, 0)) return false;
+                    opt.vScore.push_back(t);
+                }
+            }
+            else if (arg == "--actions" && hasValue) {
+                std::vector<std::string> items;
+                parseList(argv[++i], items);
+                opt.vActions.clear();
+                for (auto& item : items) {
+                    if (!parseNumber(item, value, 0) || value < 0 || value > 0xFF) return false;
+                    opt.vActions.push_back((uint8_t)value);
+                }
+            }
+            else if (arg == "--beam" && hasValue && parseNumber(argv[++i], value)) opt.nBeam = (uint32_t)std::max(1L, value);
+            else if (arg == "--depth" && hasValue && parseNumber(argv[++i], value)) opt.nDepth = (uint32_t)std::max(1L, value);
+            else if (arg == "--hold" && hasValue && parseNumber(argv[++i], value)) opt.nHold = (uint32_t)std::max(1L, value);
+            else if (arg == "--threads" && hasValue && parseNumber(argv[++i], value)) opt.nThreads = (unsigned)std::max(0L, value);
+            else if (arg == "--play" && hasValue) opt.sMovieFile = argv[++i];
+            else if (arg == "--record" && hasValue) opt.sRecordFile = argv[++i];
+            else if (arg.size() > 1 && arg[0] == '-') return false;
+            else opt.sRomFile = arg;
+        }
+        return !opt.sRomFile.empty() && !opt.vScore.empty() && !opt.vActions.empty();
+    }
+
+    void printUsage(const char* name) {
+        std::cout << "Usage: " << name << " <rom.nes> --score <addr[:weight],...> [options]\n"
+                  << "  --score <list>     RAM bytes ($000-$7FF) to maximise, e.g. 0x6D:256,0x86\n"
+                  << "  --actions <list>   Controller bytes to try (default: none, right, left, A and B combinations)\n"
+                  << "  --beam <n>         Nodes kept per step (default 32)\n"
+                  << "  --depth <n>        Steps to search (default 60)\n"
+                  << "  --hold <n>         Frames each action is held (default 8)\n"
+                  << "  --threads <n>      Worker threads (default: one per hardware thread)\n"
+                  << "  --play <file>      Start the search at the end of an input movie\n"
+                  << "  --record <file>    Save the best path as a movie\n";
+    }
+
+    long score(const Bus& bus, const std::vector<Term>& terms) {
+        long total = 0;
+        for (const Term& t : terms) total += t.nWeight * bus.cpuRam[t.nAddr];
+        return total;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    if (!parseOptions(argc, argv, opt)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    auto cart = std::make_shared<Cartridge>(opt.sRomFile);
+    if (!cart->ImageValid() || cart->IsNSF()) {
+        std::cerr << "Failed to load ROM " << opt.sRomFile << std::endl;
+        return 1;
+    }
+    Bus root;
+    root.insertCartridge(cart);
+    root.reset();
+    root.setAudioOutput(false);
+    root.ppu.setVideoOutput(false);
+
+    if (!opt.sMovieFile.empty()) {
+        Movie movie;
+        if (!movie.load(opt.sMovieFile) || !movie.start(root)) {
+            std::cerr << "Failed to load movie " << opt.sMovieFile << std::endl;
+            return 1;
+        }
+        while (movie.nextFrame(root)) root.clockFrame();
+    }
+
+    std::vector<Node> beam(1);
+    beam[0].bus = root.clone();
+    beam[0].nScore = score(root, opt.vScore);
+
+    ThreadPool pool(opt.nThreads);
+    auto tStart = std::chrono::steady_clock::now();
+    uint64_t nClones = 0;
+
+    for (uint32_t depth = 0; depth < opt.nDepth; depth++) {
+        // Expand every node by every action, in parallel
+        std::vector<Node> children(beam.size() * opt.vActions.size());
+        for (size_t i = 0; i < children.size(); i++) {
+            pool.submit([&, i] {
+                const Node& parent = beam[i / opt.vActions.size()];
+                uint8_t action = opt.vActions[i % opt.vActions.size()];
+                Node& child = children[i];
+                child.bus = parent.bus->clone();
+                child.bus->controller[0] = action;
+                child.bus->controller[1] = 0x00;
+                for (uint32_t f = 0; f < opt.nHold; f++) child.bus->clockFrame();
+                child.vPath = parent.vPath;
+                child.vPath.push_back(action);
+                child.nScore = score(*child.bus, opt.vScore);
+                child.nRamHash = Hash::hash64(child.bus->cpuRam.data(), child.bus->cpuRam.size());
+            });
+        }
+        pool.wait();
+        nClones += children.size();
+
+        // Keep the best, dropping children that reached identical RAM
+        std::stable_sort(children.begin(), children.end(), [](const Node& a, const Node& b) { return a.nScore > b.nScore; });
+        std::unordered_set<uint64_t> seen;
+        beam.clear();
+        for (auto& child : children) {
+            if (beam.size() >= opt.nBeam) break;
+            if (!seen.insert(child.nRamHash).second) continue;
+            beam.push_back(std::move(child));
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+    const Node& best = beam[0];
+    uint64_t nFrames = nClones * opt.nHold;
+    std::cout << "Best score " << best.nScore << " after " << best.vPath.size() * opt.nHold << " frames\n"
+              << "Path:";
+    for (uint8_t action : best.vPath) std::cout << " " << std::hex << std::setw(2) << std::setfill('0') << (int)action;
+    std::cout << std::dec << std::setfill(' ') << "\n"
+              << nClones << " clones, " << nFrames << " frames in " << std::fixed << std::setprecision(2) << elapsed << " s ("
+              << (elapsed > 0 ? nClones / elapsed : 0.0) << " clones/s, " << (elapsed > 0 ? nFrames / elapsed : 0.0) << " fps)" << std::endl;
+
+    if (!opt.sRecordFile.empty()) {
+        // Replay the winning path from the root to record it
+        auto replay = root.clone();
+        Movie movie;
+        movie.startRecording(*replay);
+        for (uint8_t action : best.vPath) {
+            for (uint32_t f = 0; f < opt.nHold; f++) {
+                replay->controller[0] = action;
+                replay->controller[1] = 0x00;
+                movie.record(*replay);
+                replay->clockFrame();
+            }
+        }
+        if (!movie.save(opt.sRecordFile)) {
+            std::cerr << "Failed to save movie " << opt.sRecordFile << std::endl;
+            return 1;
+        }
+        std::cout << "Recorded " << movie.FrameCount() << " frames to " << opt.sRecordFile << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "CPU.h"
+#include "InstructionTrace.h"
+
+// Decodes an instruction trace written by nes_emu --cputrace into nestest
+// style text, one line per instruction:
+//
+//   C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7
+//
+// The pre-render line is shown as scanline 261, as in nestest.log.
+
+namespace {
+    const size_t CHUNK_RECORDS = 4096;
+
+    // The whole string as an unsigned decimal number; strtoull alone
+    // would take "-1" as 2^64-1
+    bool parseCount(const std::string& s, unsigned long long& value) {
+        if (s.empty() || s[0] < '0' || s[0] > '9') return false;
+        char* end = nullptr;
+        value = std::strtoull(s.c_str(), &end, 10);
+        return *end == '\0';
+    }
+
+    void printUsage(const char* name) {
+        std::cout << "Usage: " << name << " <trace.bin> [options]\n"
+                  << "  --skip <n>         Skip the first n instructions\n"
+                  << "  --count <n>        Decode at most n instructions\n";
+    }
+
+    void printRecord(const InstructionTrace::Record& r) {
+        uint8_t nLength = 0;
+        std::string sText = CPU::disassemble(r.pc, r.bytes, nLength);
+        char bytes[12];
+        if (nLength > 1) snprintf(bytes, sizeof(bytes), nLength == 2 ? "%02X %02X" : "%02X %02X %02X", r.bytes[0], r.bytes[1], r.bytes[2]);
+        else snprintf(bytes, sizeof(bytes), "%02X", r.bytes[0]);
+
+        printf("%04X  %-8s  %-32sA:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3d,%3d CYC:%llu\n",
+               r.pc, bytes, sText.c_str(), r.a, r.x, r.y, r.status, r.stkp,
+               r.scanline < 0 ? 261 : r.scanline, r.dot, (unsigned long long)r.nCycle);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string sTraceFile;
+    unsigned long long nSkip = 0, nCount = ~0ull;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        unsigned long long value = 0;
+        if (arg == "--skip" && i + 1 < argc && parseCount(argv[++i], value)) nSkip = value;
+        else if (arg == "--count" && i + 1 < argc && parseCount(argv[++i], value)) nCount = value;
+        else if (arg.size() > 1 && arg[0] == '-') { printUsage(argv[0]); return 1; }
+        else sTraceFile = arg;
+    }
+    if (sTraceFile.empty()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    FILE* file = fopen(sTraceFile.c_str(), "rb");
+    if (!file) {
+        std::cerr << "Failed to open " << sTraceFile << std::endl;
+        return 1;
+    }
+    uint32_t header[3];
+    if (fread(header, sizeof(header), 1, file) != 1 || memcmp(header, "NCTR", 4) != 0
+        || header[1] != InstructionTrace::VERSION || header[2] != sizeof(InstructionTrace::Record)) {
+        std::cerr << sTraceFile << " is not an instruction trace" << std::endl;
+        fclose(file);
+        return 1;
+    }
+
+    if (nSkip > 0) fseek(file, (long)(nSkip * sizeof(InstructionTrace::Record)), SEEK_CUR);
+
+    std::vector<InstructionTrace::Record> vChunk(CHUNK_RECORDS);
+    while (nCount > 0) {
+        size_t n = fread(vChunk.data(), sizeof(InstructionTrace::Record), (size_t)std::min<unsigned long long>(nCount, CHUNK_RECORDS), file);
+        if (n == 0) break;
+        for (size_t i = 0; i < n; i++) printRecord(vChunk[i]);
+        nCount -= n;
+    }
+    fclose(file);
+    return 0;
+}